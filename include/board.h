@@ -1,10 +1,18 @@
 #ifndef BOARD_H
 #define BOARD_H
 
+#include <stdint.h>
+#include <pthread.h>
+#include "levels.h"
+#include "lockprof.h"
+#include "log.h"
+#include "rng.h"
+
 #define MAX_MOVES 20
 #define MAX_LEVELS 20
 #define MAX_FILENAME 256
 #define MAX_GHOSTS 25
+#define BOARD_BAND_ROWS 64  // rows guarded by each region lock, one word of the column bitmasks
 
 typedef enum {
     REACHED_PORTAL = 1,
@@ -28,6 +36,7 @@ typedef struct {
     int current_move;
     int n_moves; // number of predefined moves, 0 if controlled by user, >0 if readed from level file
     int waiting;
+    rng_t rng; // own stream for the 'R' moves
 } pacman_t;
 
 typedef struct {
@@ -38,13 +47,52 @@ typedef struct {
     int current_move;
     int waiting;
     int charged;
+    rng_t rng; // own stream for the 'R' moves
 } ghost_t;
 
+/*One board cell packed in a byte, always go through the board_cell_* accessors
+bits 0-1: what stands on the cell (CELL_EMPTY, CELL_WALL, CELL_PACMAN, CELL_GHOST)
+bit 2: there is a dot in this position
+bit 3: there is a portal in this position*/
+typedef unsigned char board_pos_t;
+
+#define CELL_OCCUPANT_MASK 0x03
+#define CELL_EMPTY  0x00
+#define CELL_WALL   0x01
+#define CELL_PACMAN 0x02
+#define CELL_GHOST  0x03
+#define CELL_DOT    0x04
+#define CELL_PORTAL 0x08
+
+struct history;
+struct level_set;
+struct pack;
+
+typedef struct {
+    int n_bands;                // bands of BOARD_BAND_ROWS rows
+    prof_mutex_t* bands;        // one lock per band, always taken in ascending order
+    prof_mutex_t journal;       // dirty list, history notes and occupancy index
+} board_locks_t;
+
+/*Steps from every cell to the pacman (walls excluded), shared by every ghost with an 'F'
+(chase) command. A BFS builds it; after a one cell pacman move it is repaired instead: every
+distance changes by exactly 1 (the grid is bipartite), so 'bias' absorbs the +1 of all cells
+and only those that got closer are visited.
+A cell's dist is only valid if its stamp is the current generation, so a rebuild never clears*/
+typedef struct {
+    int width, height;
+    int root;               // pacman cell of the field, -1 if it must be rebuilt
+    uint32_t generation;    // bumped at every rebuild
+    uint32_t* stamp;        // generation that reached each cell
+    int* dist;              // steps to the pacman minus bias
+    int bias;
+    int* queue;             // BFS frontier
+} chase_field_t;
+
 typedef struct {
-    char content;   // stuff like 'P' for pacman 'M' for monster/ghost and 'W' for wall
-    int has_dot;    // whether there is a dot in this position or not
-    int has_portal; // whether there is a portal in this position or not
-} board_pos_t;
+    int cell;               // board index of an occupied cell, -1 if the slot is free
+    int entity;             // ghost index, or -(pacman index + 1) for a pacman
+} occupant_t;
 
 typedef struct {
     int width, height;      // dimensions of the board
@@ -57,8 +105,65 @@ typedef struct {
     char pacman_file[256];  // file with pacman movements
     char ghosts_files[MAX_GHOSTS][256]; // files with monster movements
     int tempo;              // Duration of each play
+    struct history* history; // rewind journal fed by the move functions, NULL if not recording
+    int* dirty_cells;       // cells written since the last draw_board
+    int n_dirty;
+    int dirty_capacity;
+    int full_redraw;        // 1 if the whole board must be repainted
+    occupant_t* occupants;  // cell -> entity index, open addressing hash sized for the entities
+    int occupants_mask;     // number of slots - 1 (power of two)
+    uint64_t* row_blockers; // per row bitmask of cells holding 'W', 'M' or 'P', for charged moves
+    uint64_t* col_blockers; // same per column
+    board_locks_t* locks;   // region locks while ghosts move in parallel, NULL otherwise
+    chase_field_t* chase;   // distance field for 'F' ghosts, NULL until the level needs one
+    struct level_set* levels; // set this level was loaded from
 } board_t;
 
+/*Keeps the blocker bitmasks in sync with a cell whose occupant changed*/
+void board_set_blocker(board_t* board, int index, int blocked);
+
+typedef struct {
+    board_t board;          // deep copy of the saved board, owns its own arrays
+    int cells_capacity;     // cells/pacmans/ghosts the buffers hold without reallocating
+    int pacmans_capacity;
+    int ghosts_capacity;
+    int level_cursor;       // level that load_level would load next
+    int saved;              // 1 once board_snapshot succeeded
+} board_snapshot_t;
+
+/*Cell accessors
+content is one of ' ' (empty), 'W' (wall), 'P' (pacman) or 'M' (monster/ghost)*/
+static inline char board_cell_content(const board_t* board, int index) {
+    return " WPM"[board->board[index] & CELL_OCCUPANT_MASK];
+}
+
+static inline void board_set_content(board_t* board, int index, char content) {
+    board_pos_t occupant = CELL_EMPTY;
+    if (content == 'W') occupant = CELL_WALL;
+    else if (content == 'P') occupant = CELL_PACMAN;
+    else if (content == 'M') occupant = CELL_GHOST;
+    board->board[index] = (board->board[index] & ~CELL_OCCUPANT_MASK) | occupant;
+    if (board->row_blockers) board_set_blocker(board, index, occupant != CELL_EMPTY);
+}
+
+static inline int board_has_dot(const board_t* board, int index) {
+    return (board->board[index] & CELL_DOT) != 0;
+}
+
+static inline void board_set_dot(board_t* board, int index, int has_dot) {
+    if (has_dot) board->board[index] |= CELL_DOT;
+    else board->board[index] &= (board_pos_t)~CELL_DOT;
+}
+
+static inline int board_has_portal(const board_t* board, int index) {
+    return (board->board[index] & CELL_PORTAL) != 0;
+}
+
+static inline void board_set_portal(board_t* board, int index, int has_portal) {
+    if (has_portal) board->board[index] |= CELL_PORTAL;
+    else board->board[index] &= (board_pos_t)~CELL_PORTAL;
+}
+
 /*Makes the current thread sleep for 'int milliseconds' miliseconds*/
 void sleep_ms(int milliseconds);
 
@@ -68,6 +173,37 @@ command - command to be processed*/
 int move_pacman(board_t* board, int pacman_index, command_t* command);
 int move_ghost(board_t* board, int ghost_index, command_t* command);
 
+/*What one ghost play will do, worked out without writing anything*/
+typedef enum {
+    INTENT_WAIT = 0,    // still waiting its passo
+    INTENT_HOLD,        // 'T' countdown
+    INTENT_CHARGE,      // 'C'
+    INTENT_STEP,        // one cell towards to_x/to_y ('W', 'A', 'S', 'D', 'R')
+    INTENT_CHARGED,     // charged run ending on to_x/to_y
+    INTENT_INVALID,     // charged run against the edge or unknown command
+} ghost_intent_kind_t;
+
+typedef struct {
+    ghost_intent_kind_t kind;
+    int to_x, to_y;     // target cell of INTENT_STEP/INTENT_CHARGED
+    int hits_pacman;    // the charged run ends on the pacman
+} ghost_intent_t;
+
+/*move_ghost split in two phases, so every ghost of a tick can be planned in parallel
+against the same board and then committed one by one.
+plan_ghost only reads the board; the one thing it writes is the ghost's own rng, for 'R'.
+commit_ghost applies the intent, checking its target against the board as it is then*/
+void plan_ghost(board_t* board, int ghost_index, const command_t* command, ghost_intent_t* intent);
+int commit_ghost(board_t* board, int ghost_index, command_t* command, const ghost_intent_t* intent);
+
+/*Digest of the rng of every entity, changes whenever one of them draws*/
+uint64_t board_rng_digest(const board_t* board);
+
+/*Region locking for parallel move_ghost calls. While enabled, move_ghost only locks the
+bands of rows its move can touch, so ghosts in different regions move at the same time*/
+int board_enable_locks(board_t* board);
+void board_disable_locks(board_t* board);
+
 /*Process the death of a Pacman*/
 void kill_pacman(board_t* board, int pacman_index);
 
@@ -77,27 +213,89 @@ int load_pacman(board_t* board, int points);
 /*Adds a ghost(monster) to the board*/
 int load_ghost(board_t* board);
 
+/*Ordered list of the .lvl files of a directory (or the levels of a precompiled pack)
+and the next one to load. Each set is independent, so several level packs can be simulated at once*/
+typedef struct level_set {
+    level_index_t index;        // .lvl files of the directory, sorted by level number (empty for a pack)
+    struct pack* pack;          // mapped pack when the set was opened from a pack file
+    struct level_prefetch* prefetch; // next level being built in the background, NULL if none
+    int n_levels;
+    int current;                // level that level_set_load loads next
+    char base_dir[MAX_FILENAME];
+    unsigned int seed;          // session seed, every level seeds its entity streams from it
+} level_set_t;
+
+/*Fills 'levels' with the .lvl files of a directory, or maps 'level_dir' if it is a pack file*/
+int level_set_init(level_set_t* levels, const char* level_dir);
+
+/*Seeds the random moves of every level in the set (0 until set). Each entity of level n
+draws from rng_seed(rng_level_seed(seed, n), entity), whatever order the levels are loaded in*/
+void level_set_seed(level_set_t* levels, unsigned int seed);
+
+/*Loads the next level of the set into board*/
+int level_set_load(level_set_t* levels, board_t* board, int accumulated_points);
+
+/*Starts building the next level of the set on a background thread, the next
+level_set_load then only swaps it in. The list of levels must not change meanwhile*/
+int level_set_prefetch(level_set_t* levels);
+
+/*Releases the file list*/
+void level_set_free(level_set_t* levels);
+
 /*Initializes the list of levels from a directory*/
 int init_levels(const char *level_dir);
 
+/*Releases the levels of init_levels, waiting for a level still being prefetched*/
+void free_levels(void);
+
+/*level_set_seed for the levels of init_levels*/
+void seed_levels(unsigned int seed);
+
 /*Loads a level into board*/
 int load_level(board_t* board, int accumulated_points);
 
+/*Starts loading in the background the level load_level loads next*/
+int prefetch_level(void);
+
 /*Unloads levels loaded by load_level*/
 void unload_level(board_t * board);
 
-// DEBUG FILE
+/*Entity occupancy index, O(1) lookups of who stands on a cell
+Return the ghost/pacman index at (x,y) or -1 if there is none*/
+int board_ghost_at(const board_t* board, int x, int y);
+int board_pacman_at(const board_t* board, int x, int y);
+
+/*Rebuilds the occupancy index from the pacman/ghost positions*/
+int board_index_entities(board_t* board);
+
+/*Rebuilds the row/column blocker bitmasks from the cells*/
+int board_index_blockers(board_t* board);
+
+/*Brings the chase field up to date with the pacman position, a no-op if the pacman did not
+move or no ghost chases. scheduler_tick calls it once the pacman moved, before the ghosts;
+whoever plays ghosts without the scheduler calls it first*/
+int board_update_chase(board_t* board);
+
+/*Dirty cell tracking used by draw_board to repaint only what changed*/
+void board_mark_dirty(board_t* board, int index);
+void board_mark_all_dirty(board_t* board);
+void board_clear_dirty(board_t* board);
+
+/*Deep copies the board (cells, pacmans, ghosts, move cursors, charged state, entity rngs)
+into 'snap'. The snapshot buffers are reused between calls, start with a zeroed snapshot*/
+int board_snapshot(const board_t* board, board_snapshot_t* snap);
 
-/*Opens the debug file*/
-void open_debug_file(char *filename);
+/*Puts the board back into the state saved in 'snap', including the level cursor.
+The board keeps its own history pointer, dirty buffer and indexes (rebuilt),
+and is marked for a full redraw*/
+int board_restore(board_t* board, const board_snapshot_t* snap);
 
-/*Closes the debug file*/
-void close_debug_file();
+/*Releases the buffers owned by a snapshot*/
+void board_snapshot_free(board_snapshot_t* snap);
 
-/*Writes to the open debug file*/
-void debug(const char * format, ...);
+// DEBUG LOG (debug() is a macro of log.h)
 
-/*Writes the board and its contents to the open debug file*/
+/*Writes the board and its contents to the debug log*/
 void print_board(board_t* board);
 
 #endif
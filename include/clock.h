@@ -0,0 +1,70 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*Fixed-timestep game clock. Tick n of a level is due at start + n * period
+(CLOCK_MONOTONIC, absolute), so the time spent simulating, rendering or waiting
+for a lock never shifts the following ticks. A late wake-up runs the missed ticks
+back to back, up to CLOCK_MAX_CATCHUP; beyond that they are dropped and counted*/
+
+#define CLOCK_MAX_CATCHUP 4
+#define CLOCK_HIST_BUCKETS 24           // bucket i counts durations under 2^(i+1) us, the last one the rest
+
+typedef struct {
+    unsigned long buckets[CLOCK_HIST_BUCKETS];
+    unsigned long count;
+    uint64_t total_ns, max_ns;
+} clock_hist_t;
+
+typedef enum {
+    CLOCK_SIMULATE = 0,     // scheduler tick, lock wait included
+    CLOCK_RENDER,           // draw + refresh of the screen
+    CLOCK_SLEEP,            // blocked waiting for the next deadline or a key
+    CLOCK_LATE,             // how far past its deadline each tick started
+    CLOCK_N_HISTS
+} clock_hist_id_t;
+
+typedef struct {
+    uint64_t period_ns;
+    uint64_t next_ns;               // absolute deadline of the next tick
+    unsigned long ticks;            // ticks handed out by clock_due
+    unsigned long caught_up;        // of those, run back to back after a late wake-up
+    unsigned long dropped;          // deadlines skipped, more than CLOCK_MAX_CATCHUP behind
+    clock_hist_t hists[CLOCK_N_HISTS];
+} game_clock_t;
+
+/*Now on CLOCK_MONOTONIC, in nanoseconds*/
+uint64_t clock_now_ns(void);
+
+/*Clears the counters and histograms*/
+void clock_init(game_clock_t* clk);
+
+/*Restarts the deadlines: the first tick is due one period from now.
+tempo - level TEMPO in ms, 0 is run at 1 ms*/
+void clock_start(game_clock_t* clk, int tempo);
+
+/*Arms a timerfd (TFD_TIMER_ABSTIME) to fire at the next deadline*/
+int clock_arm(const game_clock_t* clk, int timer_fd);
+
+/*Number of ticks due now, 0 if the next deadline has not passed yet.
+Moves the deadline past them and records how late the first one is*/
+int clock_due(game_clock_t* clk);
+
+/*A key wants the next tick now: moves the next deadline to now, but never closer than half a
+period to the deadline before it (a held key plays at most twice as fast), and the deadlines
+go on one period apart from there. Re-arm the timerfd after it*/
+void clock_hurry(game_clock_t* clk);
+
+/*Sleeps (clock_nanosleep, TIMER_ABSTIME) until the deadline 'ticks' ticks ahead, and moves
+the deadlines past it: the pause is not counted as dropped ticks*/
+void clock_sleep_ticks(game_clock_t* clk, int ticks);
+
+/*Adds one duration to a histogram*/
+void clock_record(game_clock_t* clk, clock_hist_id_t hist, uint64_t ns);
+
+/*Tick counters and one line per histogram (count, mean, p50, p99, max) plus its buckets*/
+void clock_report(const game_clock_t* clk, FILE* out);
+
+#endif
@@ -17,6 +17,9 @@ Potential Structures for ncurses
 /*Initialize everything ncurses requires*/
 int terminal_init();
 
+/*Same as terminal_init but drawing to /dev/null on a rows x cols screen, for benchmarks*/
+int terminal_init_offscreen(int rows, int cols);
+
 /*Draw the board on the screen*/
 void draw_board(board_t* board, int mode);
 
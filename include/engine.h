@@ -0,0 +1,57 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "board.h"
+#include "scheduler.h"
+
+typedef enum {
+    ENGINE_RUNNING = 0,     // level still being played
+    ENGINE_LEVEL_DONE = 1,  // pacman reached the portal
+    ENGINE_PACMAN_DEAD = 2, // pacman was killed
+    ENGINE_NO_LEVEL = 3,    // no level loaded (not started or no more levels)
+} engine_status_t;
+
+typedef struct {
+    level_set_t levels;     // levels of the directory, owned by this engine
+    board_t board;          // board of the level being simulated
+    int loaded;             // 1 while a level is loaded into board
+    int level;              // number of levels loaded so far
+    int points;             // points carried over between levels
+    unsigned long tick;     // ticks simulated in the current level
+    engine_status_t status; // outcome of the last tick
+    int ghost_workers;      // threads playing the ghosts of each tick, 0 for none
+    sched_mode_t sched_mode; // how the ghosts of a tick are played
+    scheduler_t sched;      // advances the loaded level
+} engine_t;
+
+/*Prepares a headless engine for the levels in 'level_dir'; nothing is drawn and nothing sleeps
+ghost_workers - threads used to play the ghosts of a tick in parallel, 0 to play them in order
+sched_mode - SCHED_DIRECT or SCHED_INTENT, see scheduler.h*/
+int engine_init(engine_t* engine, const char* level_dir, int ghost_workers, sched_mode_t sched_mode);
+
+/*Makes the random moves of every level follow 'seed', so a run can be repeated*/
+void engine_seed(engine_t* engine, unsigned int seed);
+
+/*Loads the next level into the engine board, returns -1 when there are no more levels*/
+int engine_next_level(engine_t* engine);
+
+/*Loads level 'index' of the directory instead of the next one, as a replay needs*/
+int engine_load_level(engine_t* engine, int index);
+
+/*Puts the loaded level in the state saved in 'snap' (see board_restore) and lets it run again*/
+int engine_restore(engine_t* engine, const board_snapshot_t* snap);
+
+/*Simulates exactly one tick through the scheduler: one pacman play followed by one play of every ghost
+input - command for a user controlled pacman, '\0' to stay put (ignored for scripted pacmans)*/
+engine_status_t engine_step(engine_t* engine, char input);
+
+/*Read-only view of the current level*/
+const board_t* engine_board(const engine_t* engine);
+
+/*Points of the pacman in the current level, or the carried points if no level is loaded*/
+int engine_points(const engine_t* engine);
+
+/*Unloads the current level and releases everything the engine owns*/
+void engine_destroy(engine_t* engine);
+
+#endif
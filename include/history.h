@@ -0,0 +1,96 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "board.h"
+
+/*New content of one board cell after a tick*/
+typedef struct {
+    int index;
+    board_pos_t cell;
+} cell_delta_t;
+
+/*Fields of a pacman/ghost that can change during a tick.
+move_index/turns_left carry one command whose countdown changed, move_index is -1 if none*/
+typedef struct {
+    char is_ghost;
+    short index;
+    short move_index;
+    int turns_left;
+    int pos_x, pos_y;
+    int alive, points;      // pacman only
+    int charged;            // ghost only
+    int waiting;
+    int current_move;
+    rng_t rng;
+} entity_delta_t;
+
+typedef struct {
+    unsigned long tick;         // tick this entry brings the board to
+    unsigned long cell_start;   // first record in the cell pool
+    int n_cells;
+    unsigned long entity_start; // first record in the entity pool
+    int n_entities;
+} history_entry_t;
+
+typedef struct history {
+    int capacity;                   // ticks kept in the ring
+    int keyframe_interval;          // ticks between full copies of the board
+
+    history_entry_t* entries;       // ring with the deltas of the last ticks
+    int first;                      // ring position of the oldest entry
+    int count;
+
+    cell_delta_t* cells;            // ring pool of cell deltas
+    int cells_capacity;
+    unsigned long cells_head;       // total cell deltas ever written
+
+    entity_delta_t* entities;       // ring pool of entity deltas
+    int entities_capacity;
+    unsigned long entities_head;
+
+    board_snapshot_t* keyframes;    // full copies every keyframe_interval ticks
+    unsigned long* keyframe_ticks;
+    int* keyframe_valid;
+    int n_keyframes;
+
+    int* pending_cells;             // cells written during the current tick
+    int n_pending_cells;
+    int pending_capacity;
+    unsigned char* pending_pacmans; // entities touched during the current tick
+    unsigned char* pending_ghosts;
+    pacman_t* shadow_pacmans;       // entities as they were at the last commit
+    ghost_t* shadow_ghosts;
+    int n_pacmans, n_ghosts;
+
+    unsigned long tick;             // last committed tick
+} history_t;
+
+/*Prepares an empty history that keeps the last 'capacity' ticks,
+with a full keyframe every 'keyframe_interval' ticks*/
+int history_init(history_t* history, int capacity, int keyframe_interval);
+
+/*Releases everything owned by the history*/
+void history_free(history_t* history);
+
+/*Starts recording 'board' from tick 0, dropping anything recorded before*/
+int history_attach(history_t* history, board_t* board);
+
+/*Stops recording 'board'*/
+void history_detach(history_t* history, board_t* board);
+
+/*Called by board.c at every write site during a tick*/
+void history_note_cell(history_t* history, int index);
+void history_note_pacman(history_t* history, int pacman_index);
+void history_note_ghost(history_t* history, int ghost_index);
+
+/*Closes the current tick, storing only what changed since the previous one*/
+void history_commit(history_t* history, const board_t* board);
+
+/*Oldest and newest ticks history_rewind can go back to*/
+unsigned long history_oldest_tick(const history_t* history);
+unsigned long history_latest_tick(const history_t* history);
+
+/*Puts the board back as it was at the end of 'tick'. Ticks after it are discarded*/
+int history_rewind(history_t* history, board_t* board, unsigned long tick);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef LEVELS_H
+#define LEVELS_H
+
+#include <stddef.h>
+
+#define LEVEL_INDEX_CACHE ".pacmanist-index"
+#define LEVEL_INDEX_OPT_OUT "PACMANIST_NO_INDEX_CACHE"
+
+/*Sorted .lvl files of a level directory. Every path lives in one arena, and the
+list is cached in LEVEL_INDEX_CACHE inside the directory, keyed by the mtime of
+the directory, so later starts read one file instead of readdir + sort.
+With LEVEL_INDEX_OPT_OUT set in the environment the directory is scanned every time
+and nothing is written into it*/
+typedef struct {
+    char* arena;                // "<dir>/<file>\0" for every level, one after the other
+    size_t arena_len, arena_cap;
+    char** paths;               // into the arena, sorted by level number
+    int n_levels;
+    int capacity;
+} level_index_t;
+
+/*Fills 'index' from the cache if it is still valid, otherwise scans the directory and
+rewrites the cache (a directory that cannot be written is just scanned every time)*/
+int level_index_build(level_index_t* index, const char* level_dir);
+
+/*Releases the arena and the path list*/
+void level_index_free(level_index_t* index);
+
+#endif
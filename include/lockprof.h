@@ -0,0 +1,95 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+
+/*Read-write locks and mutexes that, when built with LOCK_PROFILE (make LOCK_PROFILE=1), record
+for every call site that takes them the number of acquisitions, the time spent waiting for the
+lock and the time it was held. prof_lock_report logs the sites of every lock, grouped by lock
+name and sorted by wait time, and starts over.
+Without LOCK_PROFILE every call is the plain pthread one*/
+
+#ifdef LOCK_PROFILE
+
+#include <stdatomic.h>
+
+#define LOCKPROF_MAX_HELD 8             // locks one thread can hold at the same time
+
+typedef struct {
+    pthread_rwlock_t lock;
+    const char* name;
+} prof_rwlock_t;
+
+/*Locks sharing a name (the bands of a board) are reported together*/
+typedef struct {
+    pthread_mutex_t lock;
+    const char* name;
+} prof_mutex_t;
+
+/*One call site, a static inside the macros below*/
+typedef struct lock_site {
+    const char* file;
+    int line;
+    const char* func;
+    int write;                          // 1 for wrlock and mutexes, 0 for rdlock
+    const char* lock_name;              // name of the lock the site took first
+    atomic_ulong acquisitions;
+    atomic_ulong wait_ns, max_wait_ns;
+    atomic_ulong hold_ns, max_hold_ns;
+    atomic_int registered;
+    struct lock_site* next;
+} lock_site_t;
+
+int prof_rwlock_init(prof_rwlock_t* lock, const char* name);
+void prof_rwlock_destroy(prof_rwlock_t* lock);
+void prof_rwlock_lock(prof_rwlock_t* lock, lock_site_t* site);
+void prof_rwlock_unlock(prof_rwlock_t* lock);
+
+int prof_mutex_init(prof_mutex_t* mutex, const char* name);
+void prof_mutex_destroy(prof_mutex_t* mutex);
+void prof_mutex_lock_at(prof_mutex_t* mutex, lock_site_t* site);
+void prof_mutex_unlock(prof_mutex_t* mutex);
+
+/*pthread_cond_wait on a profiled mutex: the time asleep on 'cond' is neither wait nor hold*/
+int prof_cond_wait(pthread_cond_t* cond, prof_mutex_t* mutex);
+
+/*Logs every site of every lock (log_info) and clears their counters*/
+void prof_lock_report(void);
+
+#define PROF_SITE_INIT(w) {__FILE__, __LINE__, __func__, (w), NULL, 0, 0, 0, 0, 0, 0, NULL}
+
+#define PROF_LOCK_SITE(l, w) do { \
+        static lock_site_t prof_site_ = PROF_SITE_INIT(w); \
+        prof_rwlock_lock((l), &prof_site_); \
+    } while (0)
+
+#define prof_rwlock_rdlock(l) PROF_LOCK_SITE((l), 0)
+#define prof_rwlock_wrlock(l) PROF_LOCK_SITE((l), 1)
+
+#define prof_mutex_lock(m) do { \
+        static lock_site_t prof_site_ = PROF_SITE_INIT(1); \
+        prof_mutex_lock_at((m), &prof_site_); \
+    } while (0)
+
+#else
+
+typedef pthread_rwlock_t prof_rwlock_t;
+typedef pthread_mutex_t prof_mutex_t;
+
+#define prof_rwlock_init(l, name) pthread_rwlock_init((l), NULL)
+#define prof_rwlock_destroy(l) pthread_rwlock_destroy(l)
+#define prof_rwlock_rdlock(l) pthread_rwlock_rdlock(l)
+#define prof_rwlock_wrlock(l) pthread_rwlock_wrlock(l)
+#define prof_rwlock_unlock(l) pthread_rwlock_unlock(l)
+
+#define prof_mutex_init(m, name) pthread_mutex_init((m), NULL)
+#define prof_mutex_destroy(m) pthread_mutex_destroy(m)
+#define prof_mutex_lock(m) pthread_mutex_lock(m)
+#define prof_mutex_unlock(m) pthread_mutex_unlock(m)
+#define prof_cond_wait(c, m) pthread_cond_wait((c), (m))
+
+#define prof_lock_report() ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*Asynchronous log. Every thread formats into its own lock-free ring and a flusher
+thread writes the rings to the file in batches, so logging from the game loop or
+a scheduler worker never makes a syscall. A message that does not fit in the ring
+of its thread is dropped and counted, the count is written with the next batch*/
+
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+#define LOG_OFF 4
+
+// messages below LOG_LEVEL are compiled out (make LOG_LEVEL=...)
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_DEBUG
+#endif
+
+#define LOG_RING_BYTES (64 * 1024)      // per thread, a power of two
+#define LOG_FLUSH_MS 20                 // how often the flusher drains the rings
+
+/*Opens the log file and starts the flusher. Until then every message is discarded*/
+int log_open(const char* path);
+
+/*Stops the flusher after writing everything still in the rings, and closes the file*/
+void log_close(void);
+
+/*Formats a message into the ring of the calling thread, use the macros below*/
+void log_write(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#if LOG_LEVEL <= LOG_DEBUG
+#define log_debug(...) log_write(LOG_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_INFO
+#define log_info(...) log_write(LOG_INFO, __VA_ARGS__)
+#else
+#define log_info(...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_WARN
+#define log_warn(...) log_write(LOG_WARN, __VA_ARGS__)
+#else
+#define log_warn(...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_ERROR
+#define log_error(...) log_write(LOG_ERROR, __VA_ARGS__)
+#else
+#define log_error(...) ((void)0)
+#endif
+
+// the old debug file: same messages, now through the log
+#define debug(...) log_debug(__VA_ARGS__)
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+/*Runtime counters and latency histograms. Every thread adds into its own slot
+(plain relaxed stores, no locked instructions, no sharing between cores) and a
+writer thread sums the slots and rewrites the stats file every METRICS_INTERVAL_MS,
+through a temporary file + rename so a reader never sees half a file.
+Until metrics_start nothing is counted or timed, the calls only test a flag*/
+
+#define METRICS_INTERVAL_MS 1000
+#define METRICS_HIST_BUCKETS 32         // bucket i counts durations under 2^(i+1) ns, the last one the rest
+
+typedef enum {
+    METRIC_PACMAN_MOVES = 0,    // move_pacman calls
+    METRIC_PACMAN_INVALID,      // of those, into a wall, off the board or a bad command
+    METRIC_PACMAN_DEATHS,       // pacman walked into a ghost
+    METRIC_DOTS_EATEN,
+    METRIC_PORTALS,
+    METRIC_GHOST_MOVES,         // ghost steps that changed cell
+    METRIC_GHOST_WALL_HITS,
+    METRIC_GHOST_COLLISIONS,    // a ghost blocked by another ghost
+    METRIC_GHOST_KILLS,         // a ghost moved onto the pacman
+    METRIC_WORKER_SHARES,       // ghost shares played by the scheduler workers
+    METRIC_TICKS,
+    METRIC_FRAMES,              // screen refreshes
+    METRIC_N_COUNTERS
+} metric_counter_t;
+
+typedef enum {
+    METRIC_MOVE_PACMAN_NS = 0,
+    METRIC_MOVE_GHOST_NS,       // band lock waits included
+    METRIC_WORKER_SHARE_NS,     // one worker's share of a tick
+    METRIC_LOCK_WAIT_NS,        // play_board waiting for board_lock
+    METRIC_LOCK_HOLD_NS,        // play_board holding board_lock (the scheduler tick)
+    METRIC_PLAY_BOARD_NS,       // a whole tick of play_board, trace included
+    METRIC_SCREEN_REFRESH_NS,   // draw_board + refresh
+    METRIC_N_HISTS
+} metric_hist_t;
+
+/*Starts the writer thread, which rewrites 'path' every METRICS_INTERVAL_MS*/
+int metrics_start(const char* path);
+
+/*Stops the writer after a last rewrite of the stats file*/
+void metrics_stop(void);
+
+/*Adds 'n' to a counter of the calling thread*/
+void metrics_count(metric_counter_t counter, unsigned long n);
+
+/*Start of a timed section: now in ns, or 0 while metrics are off*/
+uint64_t metrics_clock(void);
+
+/*Ends a section started with metrics_clock, adding its duration to 'hist'*/
+void metrics_elapsed(metric_hist_t hist, uint64_t started);
+
+#endif
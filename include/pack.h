@@ -0,0 +1,81 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "board.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*Precompiled level pack: one file with every level of a directory already parsed.
+Layout (native endianness, offsets from the start of the file):
+  pack_header_t
+  pack_level_t[n_levels]          in the order init_levels would play them
+  pack_behavior_t[n_behaviors]    each .p/.m file once, however many levels use it
+  cells                           width*height board_pos_t per level, walls/dots/portals only*/
+
+#define PACK_MAGIC "PACMPACK"
+#define PACK_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_levels;
+    uint32_t n_behaviors;
+    uint32_t reserved;
+    uint64_t levels_offset;
+    uint64_t behaviors_offset;
+    uint64_t file_size;
+} pack_header_t;
+
+typedef struct {
+    char name[MAX_FILENAME];        // path of the .lvl it came from, becomes level_name
+    int32_t width, height, tempo;
+    int32_t default_pac_x, default_pac_y;
+    int32_t pacman;                 // behavior of the pacman, -1 if controlled by the user
+    int32_t n_ghosts;
+    int32_t ghosts[MAX_GHOSTS];     // behavior of each ghost
+    uint64_t cells_offset;
+} pack_level_t;
+
+typedef struct {
+    int32_t command;
+    int32_t turns;
+} pack_command_t;
+
+typedef struct {
+    char name[MAX_FILENAME];        // file name as written in the level
+    int32_t valid;                  // 0 if the file did not parse, the entity then loads as from a bad file
+    int32_t passo, row, col;
+    int32_t n_moves;
+    pack_command_t moves[MAX_MOVES];
+} pack_behavior_t;
+
+typedef struct pack {
+    const unsigned char* data;      // the whole file, mapped read-only
+    size_t size;
+    const pack_header_t* header;
+    const pack_level_t* levels;
+    const pack_behavior_t* behaviors;
+} pack_t;
+
+/*Builds a pack with every level of 'level_dir', parsed with the same code load_level uses*/
+int pack_compile(const char* level_dir, const char* out_path);
+
+/*Maps a pack and checks its header and offsets, nothing else is read until a level is loaded*/
+int pack_open(pack_t* pack, const char* path);
+
+/*Unmaps the pack*/
+void pack_close(pack_t* pack);
+
+/*Level 'index' of the pack, NULL if out of range*/
+const pack_level_t* pack_level(const pack_t* pack, int index);
+
+/*Behavior 'index' of the pack, NULL for -1 or out of range*/
+const pack_behavior_t* pack_behavior(const pack_t* pack, int index);
+
+/*Grid of a level, width*height cells straight from the mapping*/
+const board_pos_t* pack_cells(const pack_t* pack, const pack_level_t* level);
+
+/*Copies the moves of a behavior into command_t form*/
+int pack_behavior_moves(const pack_behavior_t* behavior, command_t* moves);
+
+#endif
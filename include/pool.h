@@ -0,0 +1,39 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+typedef struct {
+    void (*run)(void* arg);
+    void* arg;
+} pool_task_t;
+
+/*Tasks of one worker. The owner takes from the tail, thieves from the head*/
+typedef struct {
+    pthread_mutex_t lock;
+    pool_task_t* tasks;
+    int head, tail;             // tasks[head..tail) are still queued
+    int capacity;
+} pool_deque_t;
+
+typedef struct {
+    int n_workers;
+    pool_deque_t* deques;       // one per worker
+    int next_deque;             // where pool_submit puts the next task
+    unsigned long* steals;      // tasks each worker took from another deque
+} pool_t;
+
+/*Prepares a pool of n_workers threads (at least 1), no thread is started yet*/
+int pool_init(pool_t* pool, int n_workers);
+
+/*Queues a task, spreading them round robin over the workers*/
+int pool_submit(pool_t* pool, void (*run)(void* arg), void* arg);
+
+/*Starts the workers and returns once every queued task ran. A worker that runs out
+of tasks steals the oldest ones of the others, so long simulations do not leave cores idle*/
+int pool_run(pool_t* pool);
+
+/*Releases the pool, any task still queued is dropped*/
+void pool_destroy(pool_t* pool);
+
+#endif
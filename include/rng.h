@@ -0,0 +1,46 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/*Small PRNG owned by one entity (PCG32: 64 bits of state, 32 bit outputs).
+Every pacman and ghost draws its 'R' moves from its own stream, so random moves
+need no lock, do not depend on the order the entities are played in, and a run
+is repeated exactly from the session seed*/
+typedef uint64_t rng_t;
+
+#define RNG_MULTIPLIER 6364136223846793005ULL
+#define RNG_INCREMENT 1442695040888963407ULL
+
+// splitmix64 finalizer, spreads nearby seeds over the whole state space
+static inline uint64_t rng_mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/*Seed of one level of a session*/
+static inline uint64_t rng_level_seed(uint64_t session_seed, int level) {
+    return rng_mix(session_seed ^ rng_mix((uint64_t)level));
+}
+
+/*Stream 'stream' of a level, one per entity*/
+static inline void rng_seed(rng_t* rng, uint64_t level_seed, int stream) {
+    *rng = rng_mix(level_seed + rng_mix((uint64_t)stream));
+}
+
+static inline uint32_t rng_next(rng_t* rng) {
+    uint64_t old = *rng;
+    *rng = old * RNG_MULTIPLIER + RNG_INCREMENT;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+/*Uniform in [0, n) without a division*/
+static inline uint32_t rng_below(rng_t* rng, uint32_t n) {
+    return (uint32_t)(((uint64_t)rng_next(rng) * n) >> 32);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "board.h"
+#include <pthread.h>
+
+typedef enum {
+    SCHED_DIRECT = 0,   // each ghost moves as it is played: in index order, or under the region locks with workers
+    SCHED_INTENT = 1,   // every ghost plans against the same board, then they are committed in index order
+} sched_mode_t;
+
+typedef struct {
+    board_t* board;             // board being advanced
+    sched_mode_t mode;
+    unsigned long tick;         // number of ticks advanced so far
+    int n_workers;              // 0 runs the ghosts on the calling thread
+    pthread_t* workers;         // worker threads when n_workers > 0
+    prof_mutex_t barrier_lock;
+    pthread_cond_t start;       // a new tick (or stop) was published
+    pthread_cond_t done;        // a worker finished its share of the tick
+    unsigned long generation;   // tick the workers should play
+    int finished;               // workers done with the current generation
+    int stop;                   // tells the workers to exit
+    ghost_intent_t intents[MAX_GHOSTS]; // SCHED_INTENT: plans of the tick, one per ghost
+} scheduler_t;
+
+/*Prepares a scheduler for 'board'
+n_workers - number of threads that play the ghosts of a tick in parallel, 0 for none.
+mode - how the ghosts of a tick are played. SCHED_DIRECT with workers enables the board
+region locks until scheduler_destroy; SCHED_INTENT gives the same result for any n_workers*/
+int scheduler_init(scheduler_t* sched, board_t* board, int n_workers, sched_mode_t mode);
+
+/*Parses "direct" or "intent", returns -1 for anything else*/
+int scheduler_parse_mode(const char* name, sched_mode_t* mode);
+
+/*Advances the board one tick: the pacman plays first, then every ghost that has moves,
+each one honouring its own passo/waiting. Returns once the whole tick is done.
+pacman_play - command for the pacman, NULL if it stays put this tick
+Returns the result of the pacman move (VALID_MOVE if it did not move)*/
+int scheduler_tick(scheduler_t* sched, command_t* pacman_play);
+
+/*Stops the worker threads and releases the scheduler*/
+void scheduler_destroy(scheduler_t* sched);
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "board.h"
+#include <stdio.h>
+#include <stddef.h>
+
+/*Binary trace of a session, enough to replay it bit-exactly.
+Layout:
+  header      "PACMTRC1", version, keyframe interval, scheduler mode, level directory
+  records     one type byte each, integers as LEB128 varints (zigzag when signed):
+    TICK      result, input and what the pacman did, as deltas of the previous tick
+    KEYFRAME  session tick + the whole board state, every keyframe_interval ticks
+              and "forced" whenever the state jumps (new level, quicksave restore, rewind)
+    EVENT     quicksave, restore, rewind, quit
+    INDEX     session tick and offset of every keyframe, written on close
+  footer      offset of INDEX + "PACMTIDX"
+A trace without footer (the game crashed) is still readable, the index is rebuilt by scanning*/
+
+#define TRACE_MAGIC "PACMTRC1"
+#define TRACE_INDEX_MAGIC "PACMTIDX"
+#define TRACE_VERSION 2
+#define TRACE_KEYFRAME_INTERVAL 256
+
+typedef enum {
+    TRACE_TICK = 1,
+    TRACE_KEYFRAME = 2,
+    TRACE_EVENT = 3,
+    TRACE_INDEX = 4,
+} trace_record_type_t;
+
+typedef enum {
+    TRACE_CONTINUE = 0,
+    TRACE_PORTAL = 1,
+    TRACE_DEAD = 2,
+} trace_result_t;
+
+typedef enum {
+    TRACE_EVENT_BACKUP = 1,     // quicksave taken
+    TRACE_EVENT_RESTORE = 2,    // quicksave restored after a death
+    TRACE_EVENT_REWIND = 3,     // arg = history tick rewound to
+    TRACE_EVENT_QUIT = 4,
+} trace_event_t;
+
+typedef struct {
+    unsigned char* data;
+    size_t len, cap;
+    int failed;                 // an allocation failed, the content is incomplete
+} trace_buf_t;
+
+typedef struct {
+    unsigned long tick;         // session tick of the keyframe
+    long offset;                // of its record in the file
+} trace_keyframe_ref_t;
+
+typedef struct {
+    FILE* f;
+    long offset;                // bytes written so far
+    int keyframe_interval;
+    unsigned long tick;         // session ticks written, never goes back
+    trace_buf_t buf;            // record being built
+    trace_keyframe_ref_t* index;
+    int n_index, index_capacity;
+    int last_x, last_y, last_points; // pacman after the previous record, for the deltas
+    uint64_t last_rng;          // board_rng_digest
+} trace_writer_t;
+
+typedef struct {
+    trace_record_type_t type;
+    unsigned long tick;         // session tick after this record
+    // TICK
+    trace_result_t result;
+    char input;                 // '\0' when the pacman played from its file or stood still
+    int dx, dy, dpoints;
+    int rng_changed;            // some entity drew a random move
+    // KEYFRAME
+    int forced;
+    int level;                  // index of the level in the set
+    const unsigned char* state; // encoded board, valid until the next trace_next
+    size_t state_len;
+    // EVENT
+    trace_event_t event;
+    unsigned long arg;
+} trace_record_t;
+
+typedef struct {
+    FILE* f;
+    int keyframe_interval;
+    int sched_mode;
+    char level_dir[MAX_FILENAME];
+    trace_keyframe_ref_t* index;
+    int n_index;
+    long start;                 // first record, right after the header
+    long end;                   // where the records end (INDEX or end of file)
+    unsigned long tick;
+    trace_buf_t state;
+} trace_reader_t;
+
+/*Starts a trace of a session over 'level_dir'*/
+int trace_open_write(trace_writer_t* trace, const char* path, const char* level_dir, int sched_mode);
+
+/*Records one tick: the user input given to the scheduler ('\0' if none) and its outcome*/
+void trace_tick(trace_writer_t* trace, const board_t* board, char input, trace_result_t result);
+
+/*Records the whole board; forced = the state jumped and a replay has to load it*/
+void trace_keyframe(trace_writer_t* trace, const board_t* board, int forced);
+
+void trace_event(trace_writer_t* trace, trace_event_t event, unsigned long arg);
+
+/*Writes the keyframe index and closes the file*/
+int trace_close_write(trace_writer_t* trace);
+
+/*Opens a trace and loads (or rebuilds) its keyframe index*/
+int trace_open_read(trace_reader_t* trace, const char* path);
+
+/*Reads the next record, 0 at the end of the trace*/
+int trace_next(trace_reader_t* trace, trace_record_t* rec);
+
+/*Moves to the last keyframe at or before session tick 'tick'*/
+int trace_seek(trace_reader_t* trace, unsigned long tick);
+
+void trace_close_read(trace_reader_t* trace);
+
+/*Keyframe encoding of the board, appended to 'buf'*/
+int trace_encode_state(trace_buf_t* buf, const board_t* board);
+
+/*Writes an encoded state into 'snap', a board_snapshot of the same level*/
+int trace_decode_state(const unsigned char* state, size_t len, board_snapshot_t* snap);
+
+void trace_buf_free(trace_buf_t* buf);
+
+#endif
@@ -0,0 +1,188 @@
+#include "engine.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MAX_TICKS 1000000UL
+
+typedef struct {
+    char level_name[256];
+    engine_status_t status;
+    int points;
+    unsigned long ticks;        // ticks played in the level
+} level_result_t;
+
+/*One simulation: a level directory played from the first level with one seed*/
+typedef struct {
+    const char* level_dir;
+    unsigned int seed;
+    unsigned long max_ticks;
+    int failed;                 // the directory could not be loaded
+    level_result_t* results;    // one per level reached, in order
+    int n_results;
+} batch_task_t;
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static const char* status_name(engine_status_t status) {
+    switch (status) {
+        case ENGINE_LEVEL_DONE:  return "portal";
+        case ENGINE_PACMAN_DEAD: return "dead";
+        case ENGINE_RUNNING:     return "timeout";
+        default:                 return "none";
+    }
+}
+
+// Plays the levels like the game does: in order, points carried over, stop at the first one not cleared
+static void run_simulation(void* arg) {
+    batch_task_t* task = arg;
+
+    engine_t engine;
+    if (engine_init(&engine, task->level_dir, 0, SCHED_DIRECT) != 0) {
+        task->failed = 1;
+        return;
+    }
+    engine_seed(&engine, task->seed);
+
+    while (engine_next_level(&engine) == 0) {
+        engine_status_t status = ENGINE_RUNNING;
+        while (status == ENGINE_RUNNING && engine.tick < task->max_ticks) {
+            status = engine_step(&engine, '\0');
+        }
+
+        level_result_t* results = realloc(task->results, (task->n_results + 1) * sizeof(level_result_t));
+        if (!results) {
+            perror("realloc batch results");
+            break;
+        }
+        task->results = results;
+
+        level_result_t* r = &task->results[task->n_results++];
+        strncpy(r->level_name, engine_board(&engine)->level_name, sizeof(r->level_name) - 1);
+        r->level_name[sizeof(r->level_name) - 1] = '\0';
+        r->status = status;
+        r->points = engine_points(&engine);
+        r->ticks = engine.tick;
+
+        if (status != ENGINE_LEVEL_DONE) {
+            break;
+        }
+    }
+
+    engine_destroy(&engine);
+}
+
+static void print_task(const batch_task_t* task) {
+    if (task->failed) {
+        printf("dir=%s seed=%u result=error\n", task->level_dir, task->seed);
+        return;
+    }
+    for (int i = 0; i < task->n_results; i++) {
+        const level_result_t* r = &task->results[i];
+        // -1 when the level did not end that way
+        long portal_tick = r->status == ENGINE_LEVEL_DONE ? (long)r->ticks : -1;
+        long death_tick = r->status == ENGINE_PACMAN_DEAD ? (long)r->ticks : -1;
+        printf("dir=%s seed=%u level=%s result=%s points=%d ticks_to_portal=%ld death_tick=%ld\n",
+               task->level_dir, task->seed, r->level_name, status_name(r->status),
+               r->points, portal_tick, death_tick);
+    }
+}
+
+static void usage(const char* prog) {
+    printf("Usage: %s [-j threads] [-t max_ticks_per_level] [-s first_seed] [-n seeds] <level_directory>...\n", prog);
+}
+
+int main(int argc, char** argv) {
+    unsigned long max_ticks = DEFAULT_MAX_TICKS;
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int first_seed = 1;
+    int n_seeds = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:t:s:n:")) != -1) {
+        switch (opt) {
+            case 'j':
+                n_threads = atol(optarg);
+                break;
+            case 't':
+                max_ticks = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                first_seed = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                n_seeds = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || n_seeds < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+
+    int n_dirs = argc - optind;
+    int n_tasks = n_dirs * n_seeds;
+    batch_task_t* tasks = calloc(n_tasks, sizeof(batch_task_t));
+    if (!tasks) {
+        perror("calloc batch tasks");
+        return 1;
+    }
+
+    pool_t pool;
+    if (pool_init(&pool, (int)n_threads) != 0) {
+        free(tasks);
+        return 1;
+    }
+
+    for (int d = 0; d < n_dirs; d++) {
+        for (int s = 0; s < n_seeds; s++) {
+            batch_task_t* task = &tasks[d * n_seeds + s];
+            task->level_dir = argv[optind + d];
+            task->seed = first_seed + (unsigned int)s;
+            task->max_ticks = max_ticks;
+            if (pool_submit(&pool, run_simulation, task) != 0) {
+                pool_destroy(&pool);
+                free(tasks);
+                return 1;
+            }
+        }
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = pool_run(&pool);
+    double secs = elapsed_seconds(&start);
+
+    // printed in submission order, whatever order the workers finished them
+    int failed = 0;
+    for (int t = 0; t < n_tasks; t++) {
+        print_task(&tasks[t]);
+        failed += tasks[t].failed;
+        free(tasks[t].results);
+    }
+
+    unsigned long steals = 0;
+    for (int w = 0; w < pool.n_workers; w++) {
+        steals += pool.steals[w];
+    }
+    printf("simulations=%d failed=%d threads=%d steals=%lu seconds=%.6f\n",
+           n_tasks, failed, pool.n_workers, steals, secs);
+
+    pool_destroy(&pool);
+    free(tasks);
+    return (ret != 0 || failed) ? 1 : 0;
+}
@@ -0,0 +1,297 @@
+#include "board.h"
+#include "parser.h"
+#include "display.h"
+#include "pack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_DRAW_SIZE 1024          // off-screen ncurses keeps several copies of the screen
+static const int sizes[] = {10, 64, 256, 1024, 4096};
+
+static double min_seconds = 0.2;    // each benchmark runs at least this long
+
+typedef struct {
+    char dir[64];
+    char level_path[128];
+    char ghost_path[128];
+    char pack_path[128];
+    long level_bytes;
+    long ghost_bytes;
+    level_set_t levels;
+    level_set_t pack_levels;    // same level, precompiled
+    board_t board;
+    int step;               // which command of the cycle comes next
+} bench_ctx_t;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*Runs 'op' in doubling batches until min_seconds passed and prints one line:
+bench=<name> size=<w>x<h> ops=<n> ns_per_op=<t> ops_per_sec=<r> [<unit>_per_sec=<r * units_per_op>]*/
+static void run_bench(const char* name, int size, void (*op)(bench_ctx_t*), bench_ctx_t* ctx,
+                      double units_per_op, const char* unit) {
+    long ops = 0;
+    long batch = 1;
+    double start = now_seconds();
+    double elapsed = 0;
+
+    while (elapsed < min_seconds) {
+        for (long i = 0; i < batch; i++) {
+            op(ctx);
+        }
+        ops += batch;
+        batch *= 2;
+        elapsed = now_seconds() - start;
+    }
+
+    double ns_per_op = elapsed * 1e9 / ops;
+    double ops_per_sec = ops / elapsed;
+    printf("bench=%s size=%dx%d ops=%ld ns_per_op=%.1f ops_per_sec=%.1f",
+           name, size, size, ops, ns_per_op, ops_per_sec);
+    if (unit) {
+        printf(" %s_per_sec=%.1f", unit, ops_per_sec * units_per_op);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static long write_file(const char* path, const char* text) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror("fopen bench file");
+        return -1;
+    }
+    fputs(text, f);
+    long n = ftell(f);
+    fclose(f);
+    return n;
+}
+
+/*Synthetic level: walls on the border, dots everywhere else, one portal, the pacman
+at (2,2) and one ghost at (1,1)*/
+static int write_level(bench_ctx_t* ctx, int size) {
+    snprintf(ctx->level_path, sizeof(ctx->level_path), "%s/1.lvl", ctx->dir);
+    snprintf(ctx->ghost_path, sizeof(ctx->ghost_path), "%s/bench.m", ctx->dir);
+
+    char pac_path[128];
+    snprintf(pac_path, sizeof(pac_path), "%s/bench.p", ctx->dir);
+    if (write_file(pac_path, "PASSO 0\nPOS 2 2\nD\nA\n") < 0) {
+        return -1;
+    }
+    ctx->ghost_bytes = write_file(ctx->ghost_path, "PASSO 0\nPOS 1 1\nC\nD\nC\nS\nC\nA\nC\nW\nT 2\nR\n");
+    if (ctx->ghost_bytes < 0) {
+        return -1;
+    }
+
+    FILE* f = fopen(ctx->level_path, "w");
+    if (!f) {
+        perror("fopen bench level");
+        return -1;
+    }
+    fprintf(f, "# nivel sintetico %dx%d\nDIM %d %d\nTEMPO 0\nPAC bench.p\nMON bench.m\n\n", size, size, size, size);
+    char* row = malloc(size + 2);
+    if (!row) {
+        fclose(f);
+        return -1;
+    }
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int border = (x == 0 || y == 0 || x == size - 1 || y == size - 1);
+            row[x] = border ? 'X' : 'o';
+        }
+        if (y == size - 2) row[size - 2] = '@';
+        row[size] = '\n';
+        row[size + 1] = '\0';
+        fputs(row, f);
+    }
+    free(row);
+    ctx->level_bytes = ftell(f);
+    fclose(f);
+    return 0;
+}
+
+static void remove_level(bench_ctx_t* ctx) {
+    char path[128];
+    unlink(ctx->pack_path);
+    unlink(ctx->level_path);
+    unlink(ctx->ghost_path);
+    snprintf(path, sizeof(path), "%s/bench.p", ctx->dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", ctx->dir, LEVEL_INDEX_CACHE);
+    unlink(path);
+}
+
+// Fresh copy of the synthetic level in ctx->board
+static int reload(bench_ctx_t* ctx) {
+    ctx->levels.current = 0;
+    ctx->step = 0;
+    return level_set_load(&ctx->levels, &ctx->board, 0);
+}
+
+static void op_parse_level(bench_ctx_t* ctx) {
+    board_t board;
+    int x, y;
+    memset(&board, 0, sizeof(board));
+    parse_level_file(ctx->level_path, &board, &x, &y);
+    free(board.board);
+}
+
+static void op_parse_behavior(bench_ctx_t* ctx) {
+    int passo, row, col, n_moves;
+    command_t moves[MAX_MOVES];
+    parse_behavior_file(ctx->ghost_path, &passo, &row, &col, moves, &n_moves);
+}
+
+static void op_load_level(bench_ctx_t* ctx) {
+    board_t board;
+    ctx->levels.current = 0;
+    if (level_set_load(&ctx->levels, &board, 0) == 0) {
+        unload_level(&board);
+    }
+}
+
+static void op_load_level_pack(bench_ctx_t* ctx) {
+    board_t board;
+    ctx->pack_levels.current = 0;
+    if (level_set_load(&ctx->pack_levels, &board, 0) == 0) {
+        unload_level(&board);
+    }
+}
+
+// Pacman goes right and left between (2,2) and (3,2)
+static void op_move_pacman(bench_ctx_t* ctx) {
+    command_t cmd = {ctx->step++ & 1 ? 'A' : 'D', 1, 1};
+    move_pacman(&ctx->board, 0, &cmd);
+}
+
+// Ghost goes right and left between (1,1) and (2,1)
+static void op_move_ghost(bench_ctx_t* ctx) {
+    command_t cmd = {ctx->step++ & 1 ? 'A' : 'D', 1, 1};
+    move_ghost(&ctx->board, 0, &cmd);
+}
+
+// Charge then run: right, down, left and up along the inside of the border
+static void op_move_ghost_charged(bench_ctx_t* ctx) {
+    static const char cycle[] = {'D', 'S', 'A', 'W'};
+    command_t charge = {'C', 1, 1};
+    command_t run = {cycle[ctx->step++ & 3], 1, 1};
+    move_ghost(&ctx->board, 0, &charge);
+    move_ghost(&ctx->board, 0, &run);
+}
+
+static void op_draw_full(bench_ctx_t* ctx) {
+    board_mark_all_dirty(&ctx->board);
+    draw_board(&ctx->board, DRAW_MENU);
+    refresh_screen();
+}
+
+// One ghost step, then only the cells it touched are repainted
+static void op_draw_dirty(bench_ctx_t* ctx) {
+    op_move_ghost(ctx);
+    draw_board(&ctx->board, DRAW_MENU);
+    refresh_screen();
+}
+
+static int bench_size(bench_ctx_t* ctx, int size, int draw) {
+    if (write_level(ctx, size) != 0) {
+        return -1;
+    }
+    if (level_set_init(&ctx->levels, ctx->dir) != 0) {
+        remove_level(ctx);
+        return -1;
+    }
+    double cells = (double)size * size;
+
+    run_bench("parse_level_file", size, op_parse_level, ctx, (double)ctx->level_bytes, "bytes");
+    run_bench("parse_behavior_file", size, op_parse_behavior, ctx, (double)ctx->ghost_bytes, "bytes");
+    run_bench("load_level", size, op_load_level, ctx, cells, "cells");
+
+    snprintf(ctx->pack_path, sizeof(ctx->pack_path), "%s/levels.pack", ctx->dir);
+    if (pack_compile(ctx->dir, ctx->pack_path) == 0 && level_set_init(&ctx->pack_levels, ctx->pack_path) == 0) {
+        run_bench("load_level_pack", size, op_load_level_pack, ctx, cells, "cells");
+        level_set_free(&ctx->pack_levels);
+    }
+
+    if (reload(ctx) == 0) {
+        run_bench("move_pacman", size, op_move_pacman, ctx, 0, NULL);
+        unload_level(&ctx->board);
+    }
+    if (reload(ctx) == 0) {
+        run_bench("move_ghost", size, op_move_ghost, ctx, 0, NULL);
+        unload_level(&ctx->board);
+    }
+    if (reload(ctx) == 0) {
+        // each op crosses the whole board
+        run_bench("move_ghost_charged", size, op_move_ghost_charged, ctx, size - 3, "cells");
+        unload_level(&ctx->board);
+    }
+
+    if (draw && reload(ctx) == 0) {
+        // the screen fits this board, so refresh does not walk a bigger one
+        resizeterm(size + 5, size < 80 ? 80 : size);
+        run_bench("draw_board_full", size, op_draw_full, ctx, cells, "cells");
+        board_mark_all_dirty(&ctx->board);
+        run_bench("draw_board_dirty", size, op_draw_dirty, ctx, 0, NULL);
+        unload_level(&ctx->board);
+    }
+
+    level_set_free(&ctx->levels);
+    remove_level(ctx);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    int draw = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:n")) != -1) {
+        switch (opt) {
+            case 't':
+                min_seconds = atof(optarg);
+                break;
+            case 'm':
+                max_size = atoi(optarg);
+                break;
+            case 'n':
+                draw = 0;
+                break;
+            default:
+                printf("Usage: %s [-t min_seconds_per_bench] [-m max_board_size] [-n (no draw_board)]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    bench_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    strcpy(ctx.dir, "/tmp/pacmanist-bench-XXXXXX");
+    if (!mkdtemp(ctx.dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    if (draw && terminal_init_offscreen(24, 80) != 0) {
+        fprintf(stderr, "No off-screen terminal, skipping draw_board\n");
+        draw = 0;
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && sizes[i] <= max_size; i++) {
+        if (bench_size(&ctx, sizes[i], draw && sizes[i] <= MAX_DRAW_SIZE) != 0) {
+            ret = 1;
+            break;
+        }
+    }
+
+    if (draw) {
+        terminal_cleanup();
+    }
+    rmdir(ctx.dir);
+    return ret;
+}
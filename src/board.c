@@ -1,46 +1,186 @@
 #include "board.h"
 #include "parser.h"
+#include "history.h"
+#include "pack.h"
+#include "metrics.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
-#include <stdarg.h>
 #include <string.h>
-#include <dirent.h>
+#include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+
+/* próximo nível a ser construído por uma thread enquanto o atual é jogado */
+typedef struct level_prefetch {
+    pthread_t thread;
+    const level_set_t *levels;
+    int index;                  // nível que está a ser construído
+    board_t board;
+    int result;                 // resultado do build, só lido depois do join
+} level_prefetch_t;
+
+static level_set_t g_levels;    // levels of init_levels/load_level
+
+/* espera pelo prefetch em curso e devolve-o, NULL se não havia nenhum */
+static level_prefetch_t *join_prefetch(level_set_t *levels) {
+    level_prefetch_t *pf = levels->prefetch;
+    if (pf) {
+        pthread_join(pf->thread, NULL);
+        levels->prefetch = NULL;
+    }
+    return pf;
+}
 
-FILE * debugfile;
+static void free_prefetch(level_prefetch_t *pf) {
+    if (pf) {
+        if (pf->result == 0) {
+            unload_level(&pf->board);
+        }
+        free(pf);
+    }
+}
 
-static char **g_level_files = NULL;
-static int  g_num_levels = 0;
-static int  g_current_level = 0;
-static char g_base_dir[MAX_FILENAME];
+static void discard_prefetch(level_set_t *levels) {
+    free_prefetch(join_prefetch(levels));
+}
 
+// Helper private functions for the state shared by every region (see board_locks_t)
+static inline void journal_lock(board_t* board) {
+    if (board->locks) prof_mutex_lock(&board->locks->journal);
+}
 
-// Helper private function to find and kill pacman at specific position
-static int find_and_kill_pacman(board_t* board, int new_x, int new_y) {
-    for (int p = 0; p < board->n_pacmans; p++) {
-        pacman_t* pac = &board->pacmans[p];
-        if (pac->pos_x == new_x && pac->pos_y == new_y && pac->alive) {
-            pac->alive = 0;
-            kill_pacman(board, p);
-            return DEAD_PACMAN;
-        }
-    }
-    return VALID_MOVE;
+static inline void journal_unlock(board_t* board) {
+    if (board->locks) prof_mutex_unlock(&board->locks->journal);
+}
+
+// Helper private functions to let the renderer and the rewind history know what a move wrote
+// (callers hold the journal lock)
+static inline void note_cell(board_t* board, int index) {
+    board_mark_dirty(board, index);
+    if (board->history) history_note_cell(board->history, index);
+}
+
+static inline void note_pacman(board_t* board, int pacman_index) {
+    if (board->history) history_note_pacman(board->history, pacman_index);
+}
+
+static inline void note_ghost(board_t* board, int ghost_index) {
+    if (board->history) history_note_ghost(board->history, ghost_index);
+}
+
+static inline void note_dirty(board_t* board, int index) {
+    journal_lock(board);
+    board_mark_dirty(board, index);
+    journal_unlock(board);
 }
 
 // Helper private function for getting board position index
-static inline int get_board_index(board_t* board, int x, int y) {
+static inline int get_board_index(const board_t* board, int x, int y) {
     return y * board->width + x;
 }
 
+// Helper private functions for the occupancy index (linear probing, no tombstones)
+static inline int occupant_slot(const board_t* board, int cell) {
+    return (int)(((unsigned int)cell * 2654435761u) & (unsigned int)board->occupants_mask);
+}
+
+// Entity on 'cell' (ghost index or -(pacman + 1)), INT_MIN if there is none
+static int occupant_find(const board_t* board, int cell) {
+    if (!board->occupants) {
+        // no index (board_index_entities failed or was not called yet): same answer, linear time
+        char content = board_cell_content(board, cell);
+        for (int p = 0; content == 'P' && p < board->n_pacmans; p++) {
+            if (get_board_index(board, board->pacmans[p].pos_x, board->pacmans[p].pos_y) == cell) return -(p + 1);
+        }
+        for (int g = 0; content == 'M' && g < board->n_ghosts; g++) {
+            if (get_board_index(board, board->ghosts[g].pos_x, board->ghosts[g].pos_y) == cell) return g;
+        }
+        return INT_MIN;
+    }
+    int slot = occupant_slot(board, cell);
+    while (board->occupants[slot].cell != -1) {
+        if (board->occupants[slot].cell == cell) {
+            return board->occupants[slot].entity;
+        }
+        slot = (slot + 1) & board->occupants_mask;
+    }
+    return INT_MIN;
+}
+
+static void occupant_set(board_t* board, int cell, int entity) {
+    if (!board->occupants) return;
+    int slot = occupant_slot(board, cell);
+    while (board->occupants[slot].cell != -1 && board->occupants[slot].cell != cell) {
+        slot = (slot + 1) & board->occupants_mask;
+    }
+    board->occupants[slot].cell = cell;
+    board->occupants[slot].entity = entity;
+}
+
+static void occupant_remove(board_t* board, int cell) {
+    if (!board->occupants) return;
+    int mask = board->occupants_mask;
+    int slot = occupant_slot(board, cell);
+    while (board->occupants[slot].cell != cell) {
+        if (board->occupants[slot].cell == -1) return;
+        slot = (slot + 1) & mask;
+    }
+
+    // shift back the following entries of the cluster so lookups never stop early
+    int hole = slot;
+    int next = (hole + 1) & mask;
+    while (board->occupants[next].cell != -1) {
+        int home = occupant_slot(board, board->occupants[next].cell);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            board->occupants[hole] = board->occupants[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    board->occupants[hole].cell = -1;
+}
+
+// Records an entity going from old_index to new_index once the cells were written
+static void record_move(board_t* board, int old_index, int new_index, int entity) {
+    journal_lock(board);
+    occupant_remove(board, old_index);
+    occupant_set(board, new_index, entity);
+    note_cell(board, old_index);
+    note_cell(board, new_index);
+    journal_unlock(board);
+}
+
+// Helper private function to find and kill pacman at specific position
+static int find_and_kill_pacman(board_t* board, int new_x, int new_y) {
+    journal_lock(board);
+    int p = board_pacman_at(board, new_x, new_y);
+    if (p >= 0 && board->pacmans[p].alive) {
+        // alive is read under the journal lock by the other workers, it is written under it too
+        note_pacman(board, p);
+        kill_pacman(board, p);
+        journal_unlock(board);
+        return DEAD_PACMAN;
+    }
+    journal_unlock(board);
+    return VALID_MOVE;
+}
+
 // Helper private function for checking valid position
-static inline int is_valid_position(board_t* board, int x, int y) {
+static inline int is_valid_position(const board_t* board, int x, int y) {
     return (x >= 0 && x < board->width) && (y >= 0 && y < board->height); // Inside of the board boundaries
 }
 
+// 'R': a direction from the entity's own stream, no lock needed
+static inline char random_direction(rng_t* rng) {
+    static const char directions[] = {'W', 'S', 'A', 'D'};
+    debug("RANDOM MOVE\n");
+    return directions[rng_below(rng, 4)];
+}
+
 void sleep_ms(int milliseconds) {
     struct timespec ts;
     ts.tv_sec = milliseconds / 1000;
@@ -49,7 +189,7 @@ void sleep_ms(int milliseconds) {
 }
 
 
-int move_pacman(board_t* board, int pacman_index, command_t* command) {
+static int play_pacman_move(board_t* board, int pacman_index, command_t* command) {
     if (pacman_index < 0 || !board->pacmans[pacman_index].alive) {
         return DEAD_PACMAN; // Invalid or dead pacman
     }
@@ -57,6 +197,9 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
     pacman_t* pac = &board->pacmans[pacman_index];
     int new_x = pac->pos_x;
     int new_y = pac->pos_y;
+    journal_lock(board);
+    note_pacman(board, pacman_index);
+    journal_unlock(board);
 
     // check passo
     if (pac->waiting > 0) {
@@ -68,8 +211,7 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
     char direction = command->command;
 
     if (direction == 'R') {
-        char directions[] = {'W', 'S', 'A', 'D'};
-        direction = directions[rand() % 4];
+        direction = random_direction(&pac->rng);
     }
 
     // Calculate new position based on direction
@@ -109,7 +251,7 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
     int new_index = get_board_index(board, new_x, new_y);
 
     // Check for walls
-    char target_content = board->board[new_index].content;
+    char target_content = board_cell_content(board, new_index);
 
     // Check for walls
     if (target_content == 'W') {
@@ -123,160 +265,433 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
     }
 
     // Collect points
-    if (board->board[new_index].has_dot) {
+    if (board_has_dot(board, new_index)) {
         pac->points++;
-        board->board[new_index].has_dot = 0;
+        board_set_dot(board, new_index, 0);
+        metrics_count(METRIC_DOTS_EATEN, 1);
     }
 
-    board->board[old_index].content = ' ';
+    board_set_content(board, old_index, ' ');
     pac->pos_x = new_x;
     pac->pos_y = new_y;
-    board->board[new_index].content = 'P';
+    board_set_content(board, new_index, 'P');
+    record_move(board, old_index, new_index, -(pacman_index + 1));
 
-    if (board->board[new_index].has_portal) {
+    if (board_has_portal(board, new_index)) {
         return REACHED_PORTAL;
     }
 
     return VALID_MOVE;
 }
 
-static int move_ghost_charged_direction(board_t* board, ghost_t* ghost, char direction, int* new_x, int* new_y) {
+int move_pacman(board_t* board, int pacman_index, command_t* command) {
+    uint64_t started = metrics_clock();
+    int result = play_pacman_move(board, pacman_index, command);
+
+    metrics_count(METRIC_PACMAN_MOVES, 1);
+    if (result == INVALID_MOVE) {
+        metrics_count(METRIC_PACMAN_INVALID, 1);
+    } else if (result == DEAD_PACMAN) {
+        metrics_count(METRIC_PACMAN_DEATHS, 1);
+    } else if (result == REACHED_PORTAL) {
+        metrics_count(METRIC_PORTALS, 1);
+    }
+    metrics_elapsed(METRIC_MOVE_PACMAN_NS, started);
+    return result;
+}
+
+// Helper private functions for the blocker bitmasks: bit set if the cell holds a 'W', 'M' or 'P'
+static inline int row_words(const board_t* board) {
+    return (board->width + 63) / 64;
+}
+
+static inline int col_words(const board_t* board) {
+    return (board->height + 63) / 64;
+}
+
+// First blocker in 'bits' after position 'from' (exclusive), -1 if none
+static int scan_forward(const uint64_t* bits, int n_words, int from) {
+    int pos = from + 1;
+    int w = pos / 64;
+    if (w >= n_words) return -1;
+
+    uint64_t word = bits[w] & (~0ULL << (pos % 64));
+    while (!word) {
+        if (++w >= n_words) return -1;
+        word = bits[w];
+    }
+    return w * 64 + __builtin_ctzll(word);
+}
+
+// Last blocker in 'bits' before position 'from' (exclusive), -1 if none
+static int scan_backward(const uint64_t* bits, int from) {
+    if (from <= 0) return -1;
+    int pos = from - 1;
+    int w = pos / 64;
+
+    uint64_t word = bits[w] & (~0ULL >> (63 - pos % 64));
+    while (!word) {
+        if (--w < 0) return -1;
+        word = bits[w];
+    }
+    return w * 64 + 63 - __builtin_clzll(word);
+}
+
+// Cell by cell version of the bitmask scans, for a board whose masks could not be allocated:
+// coordinate of the first 'W'/'M'/'P' from (x,y) going (dx,dy), -1 if none
+static int walk_to_blocker(const board_t* board, int x, int y, int dx, int dy) {
+    for (x += dx, y += dy; is_valid_position(board, x, y); x += dx, y += dy) {
+        if ((board->board[get_board_index(board, x, y)] & CELL_OCCUPANT_MASK) != CELL_EMPTY) {
+            return dx ? x : y;
+        }
+    }
+    return -1;
+}
+
+// Charged run against the board as it is: stops before the first 'W'/'M' or on a 'P'
+static ghost_intent_kind_t plan_charged_run(const board_t* board, const ghost_t* ghost, char direction, ghost_intent_t* intent) {
     int x = ghost->pos_x;
     int y = ghost->pos_y;
-    *new_x = x;
-    *new_y = y;
+    int* new_x = &intent->to_x;
+    int* new_y = &intent->to_y;
+
+    // no masks when board_index_blockers failed (a restore short of memory): walk the cells
+    int masks = board->row_blockers != NULL && board->col_blockers != NULL;
+    const uint64_t* row = masks ? &board->row_blockers[(size_t)y * row_words(board)] : NULL;
+    const uint64_t* col = masks ? &board->col_blockers[(size_t)x * col_words(board)] : NULL;
+    int hit;        // coordinate of the first blocker along the line, -1 if none
+    int* axis;      // coordinate that changes with this direction
+    int step;       // +1 moving towards higher coordinates, -1 otherwise
 
     switch (direction) {
         case 'W': // Up
-            if (y == 0) return INVALID_MOVE;
+            if (y == 0) return INTENT_INVALID;
+            hit = masks ? scan_backward(col, y) : walk_to_blocker(board, x, y, 0, -1);
+            axis = new_y;
+            step = -1;
             *new_y = 0; // In case there is no colision
-            for (int i = y - 1; i >= 0; i--) {
-                char target_content = board->board[get_board_index(board, x, i)].content;
-                if (target_content == 'W' || target_content == 'M') {
-                    *new_y = i + 1; // stop before colision
-                    return VALID_MOVE;
-                }
-                else if (target_content == 'P') {
-                    *new_y = i;
-                    return find_and_kill_pacman(board, *new_x, *new_y);
-                }
-            }
             break;
 
         case 'S': // Down
-            if (y == board->height - 1) return INVALID_MOVE;
+            if (y == board->height - 1) return INTENT_INVALID;
+            hit = masks ? scan_forward(col, col_words(board), y) : walk_to_blocker(board, x, y, 0, 1);
+            if (hit >= board->height) hit = -1;
+            axis = new_y;
+            step = 1;
             *new_y = board->height - 1; // In case there is no colision
-            for (int i = y + 1; i < board->height; i++) {
-                char target_content = board->board[get_board_index(board, x, i)].content;
-                if (target_content == 'W' || target_content == 'M') {
-                    *new_y = i - 1; // stop before colision
-                    return VALID_MOVE;
-                }
-                if (target_content == 'P') {
-                    *new_y = i;
-                    return find_and_kill_pacman(board, *new_x, *new_y);
-                }
-            }
             break;
 
         case 'A': // Left
-            if (x == 0) return INVALID_MOVE;
+            if (x == 0) return INTENT_INVALID;
+            hit = masks ? scan_backward(row, x) : walk_to_blocker(board, x, y, -1, 0);
+            axis = new_x;
+            step = -1;
             *new_x = 0; // In case there is no colision
-            for (int j = x - 1; j >= 0; j--) {
-                char target_content = board->board[get_board_index(board, j, y)].content;
-                if (target_content == 'W' || target_content == 'M') {
-                    *new_x = j + 1; // stop before colision
-                    return VALID_MOVE;
-                }
-                if (target_content == 'P') {
-                    *new_x = j;
-                    return find_and_kill_pacman(board, *new_x, *new_y);
-                }
-            }
             break;
 
         case 'D': // Right
-            if (x == board->width - 1) return INVALID_MOVE;
+            if (x == board->width - 1) return INTENT_INVALID;
+            hit = masks ? scan_forward(row, row_words(board), x) : walk_to_blocker(board, x, y, 1, 0);
+            if (hit >= board->width) hit = -1;
+            axis = new_x;
+            step = 1;
             *new_x = board->width - 1; // In case there is no colision
-            for (int j = x + 1; j < board->width; j++) {
-                char target_content = board->board[get_board_index(board, j, y)].content;
-                if (target_content == 'W' || target_content == 'M') {
-                    *new_x = j - 1; // stop before colision
-                    return VALID_MOVE;
-                }
-                if (target_content == 'P') {
-                    *new_x = j;
-                    return find_and_kill_pacman(board, *new_x, *new_y);
-                }
-            }
             break;
+
         default:
-            debug("DEFAULT CHARGED MOVE - direction = %c\n", direction);
-            return INVALID_MOVE;
+            return INTENT_INVALID;
     }
-    return VALID_MOVE;
-}   
 
-int move_ghost(board_t* board, int ghost_index, command_t* command) {
-    if (ghost_index < 0) {
-        return INVALID_MOVE; // Invalid ghost_index
+    if (hit < 0) {
+        return INTENT_CHARGED;
+    }
+
+    *axis = hit;
+    if (board_cell_content(board, get_board_index(board, *new_x, *new_y)) == 'P') {
+        intent->hits_pacman = 1;
+        return INTENT_CHARGED;
+    }
+    *axis = hit - step; // 'W' or 'M', stop before colision
+    return INTENT_CHARGED;
+}
+
+static inline void step_towards(char direction, int* x, int* y) {
+    if (direction == 'W') (*y)--;
+    else if (direction == 'S') (*y)++;
+    else if (direction == 'A') (*x)--;
+    else if (direction == 'D') (*x)++;
+}
+
+// Helper private functions for the chase field of the 'F' ghosts
+static void free_chase(board_t* board) {
+    if (!board->chase) {
+        return;
+    }
+    free(board->chase->stamp);
+    free(board->chase->dist);
+    free(board->chase->queue);
+    free(board->chase);
+    board->chase = NULL;
+}
+
+static int has_chasers(const board_t* board) {
+    for (int g = 0; g < board->n_ghosts; g++) {
+        for (int m = 0; m < board->ghosts[g].n_moves; m++) {
+            if (board->ghosts[g].moves[m].command == 'F') {
+                return 1;
+            }
+        }
     }
+    return 0;
+}
 
+// (Re)sizes the field for the board, a restore can bring other dimensions
+static int reserve_chase(board_t* board) {
+    chase_field_t* field = board->chase;
+    if (field && field->width == board->width && field->height == board->height) {
+        return 0;
+    }
+    free_chase(board);
+
+    size_t n_cells = (size_t)board->width * board->height;
+    field = calloc(1, sizeof(chase_field_t));
+    if (!field) {
+        perror("calloc chase field");
+        return -1;
+    }
+    field->stamp = calloc(n_cells, sizeof(uint32_t));
+    field->dist = malloc(n_cells * sizeof(int));
+    field->queue = malloc(n_cells * sizeof(int));
+    board->chase = field;
+    if (!field->stamp || !field->dist || !field->queue) {
+        perror("malloc chase field");
+        free_chase(board);
+        return -1;
+    }
+    field->width = board->width;
+    field->height = board->height;
+    field->root = -1;
+    return 0;
+}
+
+// Cells next to 'cell' in W, S, A, D order, -1 off the board
+static inline void chase_neighbours(const board_t* board, int cell, int next[4]) {
+    int x = cell % board->width;
+    int y = cell / board->width;
+    next[0] = y > 0 ? cell - board->width : -1;
+    next[1] = y < board->height - 1 ? cell + board->width : -1;
+    next[2] = x > 0 ? cell - 1 : -1;
+    next[3] = x < board->width - 1 ? cell + 1 : -1;
+}
+
+// BFS from the pacman, ghosts do not block (they will have moved by the time it matters)
+static void build_chase(board_t* board, chase_field_t* field, int root) {
+    // a new generation invalidates every cell at once
+    field->generation++;
+    if (field->generation == 0) {
+        memset(field->stamp, 0, (size_t)board->width * board->height * sizeof(uint32_t));
+        field->generation = 1;
+    }
+    uint32_t gen = field->generation;
+
+    int head = 0, tail = 0;
+    field->queue[tail++] = root;
+    field->stamp[root] = gen;
+    field->dist[root] = 0;
+    field->bias = 0;
+    while (head < tail) {
+        int cell = field->queue[head++];
+        int next[4];
+        chase_neighbours(board, cell, next);
+        for (int i = 0; i < 4; i++) {
+            int n = next[i];
+            if (n < 0 || field->stamp[n] == gen || board_cell_content(board, n) == 'W') {
+                continue;
+            }
+            field->stamp[n] = gen;
+            field->dist[n] = field->dist[cell] + 1;
+            field->queue[tail++] = n;
+        }
+    }
+}
+
+// The pacman stepped from field->root to the next cell 'root'. A cell gets one step closer
+// if a shortest path to it went through 'root', one step farther otherwise: the bias takes
+// the +1 of every cell and the walk below, over the old shortest paths leaving 'root', the -2
+// of the closer ones. 0 if the field was repaired, -1 if it must be rebuilt
+static int repair_chase(board_t* board, chase_field_t* field, int root) {
+    if (field->root < 0 || field->stamp[root] != field->generation ||
+        field->dist[root] != field->dist[field->root] + 1 || field->bias >= INT_MAX / 2) {
+        return -1;  // first build, a jump (portal, restore) or a bias about to overflow
+    }
+    uint32_t gen = field->generation;
+
+    // a cell is lowered as it is queued, so an old successor has exactly the old dist + 1
+    // (neighbours differ by at most 1, a lowered one can not match)
+    int head = 0, tail = 0;
+    field->queue[tail++] = root;
+    field->dist[root] -= 2;
+    field->bias += 1;
+    while (head < tail) {
+        int cell = field->queue[head++];
+        int old = field->dist[cell] + 2;
+        int next[4];
+        chase_neighbours(board, cell, next);
+        for (int i = 0; i < 4; i++) {
+            int n = next[i];
+            if (n < 0 || field->stamp[n] != gen || field->dist[n] != old + 1) {
+                continue;
+            }
+            field->dist[n] -= 2;
+            field->queue[tail++] = n;
+        }
+    }
+    return 0;
+}
+
+int board_update_chase(board_t* board) {
+    if (!board->chase && !has_chasers(board)) {
+        return 0;
+    }
+    if (reserve_chase(board) != 0) {
+        return -1;
+    }
+
+    chase_field_t* field = board->chase;
+    const pacman_t* pac = &board->pacmans[0];
+    int root = get_board_index(board, pac->pos_x, pac->pos_y);
+    if (root == field->root) {
+        return 0;   // the pacman did not move, every ghost keeps using this field
+    }
+
+    if (repair_chase(board, field, root) != 0) {
+        build_chase(board, field, root);
+    }
+    field->root = root;
+    return 0;
+}
+
+// Neighbour of the ghost one step closer to the pacman (W, S, A, D wins a tie), 0 if there is none
+static int chase_step(const board_t* board, const ghost_t* ghost, int* to_x, int* to_y) {
+    const chase_field_t* field = board->chase;
+    if (!field || field->root < 0) {
+        return 0;
+    }
+    static const char directions[] = {'W', 'S', 'A', 'D'};
+    int here = get_board_index(board, ghost->pos_x, ghost->pos_y);
+    // dist is compared as stored, every cell has the same bias
+    int best = field->stamp[here] == field->generation ? field->dist[here] : INT_MAX;
+    int found = 0;
+
+    for (int i = 0; i < 4; i++) {
+        int x = ghost->pos_x, y = ghost->pos_y;
+        step_towards(directions[i], &x, &y);
+        if (!is_valid_position(board, x, y)) {
+            continue;
+        }
+        int cell = get_board_index(board, x, y);
+        if (field->stamp[cell] == field->generation && field->dist[cell] < best) {
+            best = field->dist[cell];
+            *to_x = x;
+            *to_y = y;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+void plan_ghost(board_t* board, int ghost_index, const command_t* command, ghost_intent_t* intent) {
     ghost_t* ghost = &board->ghosts[ghost_index];
-    int new_x = ghost->pos_x;
-    int new_y = ghost->pos_y;
+    intent->to_x = ghost->pos_x;
+    intent->to_y = ghost->pos_y;
+    intent->hits_pacman = 0;
 
     // check passo
     if (ghost->waiting > 0) {
-        ghost->waiting -= 1;
-        return VALID_MOVE;
+        intent->kind = INTENT_WAIT;
+        return;
     }
-    ghost->waiting = ghost->passo;
-
-    char direction = command->command;
-    debug("COMMAND: %c\n", command->command);
 
-    // Calculate new position based on direction
-    switch (direction) {
+    switch (command->command) {
         case 'W': // Up
         case 'S': // Down
         case 'A': // Left
         case 'D': // Right
             if (ghost->charged == 1) {
-                move_t res = move_ghost_charged_direction(board, ghost, direction, &new_x, &new_y);
-                if (res == DEAD_PACMAN || res == VALID_MOVE) {
-                    ghost->charged = 0;
-                    command->turns_left = command->turns;
-                    ghost->current_move += 1;
-                    break;
-                } else {
-                    return INVALID_MOVE;
-                }
+                intent->kind = plan_charged_run(board, ghost, command->command, intent);
+                return;
             }
-            if (direction == 'W') new_y--;
-            else if (direction == 'S') new_y++;
-            else if (direction == 'A') new_x--;
-            else if (direction == 'D') new_x++;
-            break;
-        case 'R': // Random direction
-        {
-            debug("RANDOM MOVE\n");
-            char directions[] = {'W', 'S', 'A', 'D'};
-            direction = directions[rand() % 4];
-
-            if (direction == 'W') new_y--;
-            else if (direction == 'S') new_y++;
-            else if (direction == 'A') new_x--;
-            else if (direction == 'D') new_x++;
+            intent->kind = INTENT_STEP;
+            step_towards(command->command, &intent->to_x, &intent->to_y);
+            return;
+        case 'R': // Random direction, from the ghost's own stream
+            intent->kind = INTENT_STEP;
+            step_towards(random_direction(&ghost->rng), &intent->to_x, &intent->to_y);
+            return;
+        case 'F': // Chase, one step closer to the pacman; with no way closer it stays on 'F'
+            intent->kind = chase_step(board, ghost, &intent->to_x, &intent->to_y) ? INTENT_STEP : INTENT_INVALID;
+            return;
+        case 'C': // Charge, next movement will be in straight line
+            intent->kind = INTENT_CHARGE;
+            return;
+        case 'T': // Wait (T n)
+            intent->kind = INTENT_HOLD;
+            return;
+        default:
+            intent->kind = INTENT_INVALID; // Invalid direction
+            return;
+    }
+}
+
+int commit_ghost(board_t* board, int ghost_index, command_t* command, const ghost_intent_t* intent) {
+    ghost_t* ghost = &board->ghosts[ghost_index];
+    int new_x = intent->to_x;
+    int new_y = intent->to_y;
+    journal_lock(board);
+    note_ghost(board, ghost_index);
+    journal_unlock(board);
+
+    if (intent->kind == INTENT_WAIT) {
+        ghost->waiting -= 1;
+        return VALID_MOVE;
+    }
+    ghost->waiting = ghost->passo;
+
+    debug("COMMAND: %c\n", command->command);
+
+    switch (intent->kind) {
+        case INTENT_CHARGED: {
+            // a run planned at the start of the tick can cross a ghost committed before this
+            // one: the live bitmasks cut it at the first new blocker (never make it longer)
+            ghost_intent_t live = *intent;
+            live.hits_pacman = 0;
+            int hits_pacman = intent->hits_pacman;
+            if (plan_charged_run(board, ghost, command->command, &live) == INTENT_CHARGED &&
+                abs(live.to_x - ghost->pos_x) + abs(live.to_y - ghost->pos_y) <
+                abs(new_x - ghost->pos_x) + abs(new_y - ghost->pos_y)) {
+                new_x = live.to_x;
+                new_y = live.to_y;
+                hits_pacman = live.hits_pacman;
+            }
+            if (hits_pacman) {
+                find_and_kill_pacman(board, new_x, new_y);
+            }
+            ghost->charged = 0;
+            note_dirty(board, get_board_index(board, ghost->pos_x, ghost->pos_y));
+            command->turns_left = command->turns;
+            ghost->current_move += 1;
             break;
         }
-        case 'C': // Charge, next movement will be in straight line
+        case INTENT_STEP:
+            break;
+        case INTENT_CHARGE:
             debug("CHARGED MODE\n");
             ghost->charged = 1;
+            note_dirty(board, get_board_index(board, ghost->pos_x, ghost->pos_y)); // drawn dimmed
             command->turns_left = command->turns;
             ghost->current_move += 1;
             return VALID_MOVE;
-        case 'T': // Wait (T n)
+        case INTENT_HOLD:
             debug("Wait: %d\n", command->turns_left);
             if (command->turns_left == 1) {
                 ghost->current_move += 1; // move on
@@ -286,7 +701,7 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
             }
             return VALID_MOVE;
         default:
-            return INVALID_MOVE; // Invalid direction
+            return INVALID_MOVE;
     }
 
     // Logic for the WASD movement for ghost
@@ -300,31 +715,158 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
     int old_index = get_board_index(board, ghost->pos_x, ghost->pos_y);
     int new_index = get_board_index(board, new_x, new_y);
 
-    // Check for walls
-    char target_content = board->board[new_index].content;
+    // The target is checked against the board as it is now: a ghost committed earlier
+    // in the tick may have taken the cell the intent was computed for
+    char target_content = board_cell_content(board, new_index);
 
     if (target_content == 'W') {
         debug("COLISION DETECTED: %c\n", target_content);
+        metrics_count(METRIC_GHOST_WALL_HITS, 1);
         return INVALID_MOVE;
     }
     if (target_content == 'M') {
         debug("Movement monster failure: Another monster in the way\n");
+        metrics_count(METRIC_GHOST_COLLISIONS, 1);
         return INVALID_MOVE;
     }
     if (target_content == 'P') {
         debug("Movement monster success: pacman killed\n");
+        metrics_count(METRIC_GHOST_KILLS, 1);
         return find_and_kill_pacman(board, new_x, new_y);
     }
 
     // Move ghost
-    board->board[old_index].content = ' ';
+    board_set_content(board, old_index, ' ');
     ghost->pos_x = new_x;
     ghost->pos_y = new_y;
-    board->board[new_index].content = 'M';
+    board_set_content(board, new_index, 'M');
+    record_move(board, old_index, new_index, ghost_index);
+    metrics_count(METRIC_GHOST_MOVES, 1);
 
     return VALID_MOVE;
 }
 
+uint64_t board_rng_digest(const board_t* board) {
+    uint64_t digest = 0;
+    for (int i = 0; i < board->n_pacmans; i++) {
+        digest = rng_mix(digest ^ board->pacmans[i].rng);
+    }
+    for (int i = 0; i < board->n_ghosts; i++) {
+        digest = rng_mix(digest ^ board->ghosts[i].rng);
+    }
+    return digest;
+}
+
+// One play planned and committed at once, against the board as it is now
+static int play_ghost_move(board_t* board, int ghost_index, command_t* command) {
+    ghost_intent_t intent;
+    plan_ghost(board, ghost_index, command, &intent);
+    return commit_ghost(board, ghost_index, command, &intent);
+}
+
+// Bands of rows this play can read or write, from 'first' to 'last' (empty if last < first)
+static void ghost_move_bands(const board_t* board, const ghost_t* ghost, const command_t* command, int* first, int* last) {
+    int last_band = board->locks->n_bands - 1;
+    int y = ghost->pos_y;
+    int up = y, down = y;
+
+    *first = 0;
+    *last = -1;
+    if (ghost->waiting > 0) {
+        return;
+    }
+
+    switch (command->command) {
+        case 'W':
+            if (ghost->charged) up = 0;
+            else up = y - 1;
+            break;
+        case 'S':
+            if (ghost->charged) down = board->height - 1;
+            else down = y + 1;
+            break;
+        case 'A':
+        case 'D':
+            break;
+        case 'R':
+        case 'F':
+            up = y - 1;
+            down = y + 1;
+            break;
+        default:
+            return; // 'C' and 'T' do not touch any cell
+    }
+
+    *first = (up < 0 ? 0 : up) / BOARD_BAND_ROWS;
+    *last = (down >= board->height ? board->height - 1 : down) / BOARD_BAND_ROWS;
+    // a restore may bring a taller board, its extra rows share the last lock
+    if (*first > last_band) *first = last_band;
+    if (*last > last_band) *last = last_band;
+}
+
+int move_ghost(board_t* board, int ghost_index, command_t* command) {
+    if (ghost_index < 0) {
+        return INVALID_MOVE; // Invalid ghost_index
+    }
+    uint64_t started = metrics_clock();
+    if (!board->locks) {
+        int result = play_ghost_move(board, ghost_index, command);
+        metrics_elapsed(METRIC_MOVE_GHOST_NS, started);
+        return result;
+    }
+
+    int first, last;
+    ghost_move_bands(board, &board->ghosts[ghost_index], command, &first, &last);
+    for (int b = first; b <= last; b++) {
+        prof_mutex_lock(&board->locks->bands[b]);
+    }
+
+    int result = play_ghost_move(board, ghost_index, command);
+
+    for (int b = last; b >= first; b--) {
+        prof_mutex_unlock(&board->locks->bands[b]);
+    }
+    metrics_elapsed(METRIC_MOVE_GHOST_NS, started);
+    return result;
+}
+
+int board_enable_locks(board_t* board) {
+    board_locks_t* locks = malloc(sizeof(board_locks_t));
+    if (!locks) {
+        perror("malloc board locks");
+        return -1;
+    }
+    locks->n_bands = (board->height + BOARD_BAND_ROWS - 1) / BOARD_BAND_ROWS;
+    if (locks->n_bands < 1) locks->n_bands = 1;
+    locks->bands = malloc((size_t)locks->n_bands * sizeof(prof_mutex_t));
+    if (!locks->bands) {
+        perror("malloc board bands");
+        free(locks);
+        return -1;
+    }
+    for (int b = 0; b < locks->n_bands; b++) {
+        prof_mutex_init(&locks->bands[b], "board band");
+    }
+    prof_mutex_init(&locks->journal, "board journal");
+
+    board->locks = locks;
+    return 0;
+}
+
+void board_disable_locks(board_t* board) {
+    board_locks_t* locks = board->locks;
+    if (!locks) {
+        return;
+    }
+    for (int b = 0; b < locks->n_bands; b++) {
+        prof_mutex_destroy(&locks->bands[b]);
+    }
+    prof_mutex_destroy(&locks->journal);
+    free(locks->bands);
+    free(locks);
+    board->locks = NULL;
+}
+
 
 void kill_pacman(board_t* board, int pacman_index) {
     board->pacmans[pacman_index].alive = 0;
@@ -332,7 +874,7 @@ void kill_pacman(board_t* board, int pacman_index) {
 
 /* Static Loading */
 int load_pacman(board_t* board, int points) {
-    board->board[1 * board->width + 1].content = 'P'; // Pacman
+    board_set_content(board, 1 * board->width + 1, 'P'); // Pacman
     board->pacmans[0].pos_x = 1;
     board->pacmans[0].pos_y = 1;
     board->pacmans[0].alive = 1;
@@ -343,7 +885,7 @@ int load_pacman(board_t* board, int points) {
 // Static Loading
 int load_ghost(board_t* board) {
     // Ghost 0
-    board->board[3 * board->width + 1].content = 'M'; // Monster
+    board_set_content(board, 3 * board->width + 1, 'M'); // Monster
     
     board->ghosts[0].pos_x = 1;
     board->ghosts[0].pos_y = 3;
@@ -354,7 +896,7 @@ int load_ghost(board_t* board) {
     board->ghosts[0].charged = 0;
 
     // Ghost 1
-    board->board[3 * board->width + 8].content = 'M'; // Monster
+    board_set_content(board, 3 * board->width + 8, 'M'); // Monster
     
     board->ghosts[1].pos_x = 8;
     board->ghosts[1].pos_y = 3;
@@ -428,99 +970,68 @@ int load_ghost(board_t* board) {
     return 0;
 }
 
-/* extrai o número do nome de ficheiro */
-static int extract_level_number(const char *filename) {
-    const char *p = filename;
-
-    // avança até ao primeiro dígito
-    while (*p && !(*p >= '0' && *p <= '9')){
-        p++;
-    }
-
-    return atoi(p); // atoi lê o número até encontrar "."
-}
-
-/* compara nomes do livel para os organizar */
-static int cmp_level_names(const void *a, const void *b) {
-    const char *A = *(const char **)a;
-    const char *B = *(const char **)b;
-
-    int numA = extract_level_number(A);
-    int numB = extract_level_number(B);
-
-    return (numA - numB);
-}
-
-
-int init_levels(const char *level_dir) {
-    g_num_levels = 0;
-    g_current_level = 0;
+int level_set_init(level_set_t *levels, const char *level_dir) {
+    memset(&levels->index, 0, sizeof(levels->index));
+    levels->n_levels = 0;
+    levels->current = 0;
+    levels->seed = 0;
+    levels->pack = NULL;
+    levels->prefetch = NULL;
 
     // guarda a diretoria base
-    strncpy(g_base_dir, level_dir, sizeof(g_base_dir) - 1);
-    g_base_dir[sizeof(g_base_dir) - 1] = '\0';
-
-    // se já existia uma lista, liberta
-    if (g_level_files != NULL) {
-        for (int i = 0; i < g_num_levels; ++i) {
-            free(g_level_files[i]);
-        }
-        free(g_level_files);
-        g_level_files = NULL;
-    }
-
-    DIR *dir = opendir(level_dir);
-    if (!dir) {
-        perror("opendir init_levels");
-        return -1;
-    }
-
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) {
-        const char *name = ent->d_name;
-
-        // ignora "." e ".."
-        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
-            continue;
-
-        // aceita só ficheiros que terminem em .lvl
-        size_t len = strlen(name);
-        if (len < 4 || strcmp(name + (len - 4), ".lvl") != 0)
-            continue;
-
-        // constrói caminho completo: "<dir>/<ficheiro>"
-        char fullpath[MAX_FILENAME + 2];    // +2 para aceitar o /0 no fullpath (256 + 2)
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", level_dir, name);
-
-        // aumenta o array dinamicamente
-        char **tmp = realloc(g_level_files, (g_num_levels + 1) * sizeof(char *));
-        if (!tmp) {
-            perror("realloc g_level_files");
-            closedir(dir);
+    strncpy(levels->base_dir, level_dir, sizeof(levels->base_dir) - 1);
+    levels->base_dir[sizeof(levels->base_dir) - 1] = '\0';
+
+    // um ficheiro em vez de uma diretoria é um pack pré-compilado
+    struct stat st;
+    if (stat(level_dir, &st) == 0 && S_ISREG(st.st_mode)) {
+        levels->pack = malloc(sizeof(pack_t));
+        if (!levels->pack || pack_open(levels->pack, level_dir) != 0) {
+            free(levels->pack);
+            levels->pack = NULL;
             return -1;
         }
-        g_level_files = tmp;
-
-        g_level_files[g_num_levels] = strdup(fullpath);
-        if (!g_level_files[g_num_levels]) {
-            perror("strdup level path");
-            closedir(dir);
+        levels->n_levels = (int)levels->pack->header->n_levels;
+        if (levels->n_levels == 0) {
+            fprintf(stderr, "No levels in pack %s\n", level_dir);
+            level_set_free(levels);
             return -1;
         }
+        return 0;
+    }
 
-        g_num_levels++;
+    // lista ordenada dos .lvl, lida da cache da diretoria quando ainda é válida
+    if (level_index_build(&levels->index, level_dir) != 0) {
+        return -1;
     }
+    levels->n_levels = levels->index.n_levels;
+    return 0;
+}
 
-    closedir(dir);
+void level_set_seed(level_set_t *levels, unsigned int seed) {
+    levels->seed = seed;
+}
 
-    if (g_num_levels == 0) {
-        fprintf(stderr, "No .lvl files found in %s\n", level_dir);
-        return -1;
+void level_set_free(level_set_t *levels) {
+    discard_prefetch(levels);
+    level_index_free(&levels->index);
+    if (levels->pack) {
+        pack_close(levels->pack);
+        free(levels->pack);
+        levels->pack = NULL;
     }
+    levels->n_levels = 0;
+    levels->current = 0;
+}
 
-    qsort(g_level_files, g_num_levels, sizeof(char *), cmp_level_names);
+int init_levels(const char *level_dir) {
+    // se já existia uma lista, liberta
+    level_set_free(&g_levels);
+    return level_set_init(&g_levels, level_dir);
+}
 
-    return 0;
+void free_levels(void) {
+    level_set_free(&g_levels);
 }
 
 
@@ -544,17 +1055,10 @@ static void place_default_pacman(board_t *board, int points, int default_pac_x,
     pac->current_move = 0;
     pac->n_moves = 0;  /* 0 = controlado pelo utilizador */
 
-    board->board[get_board_index(board, x, y)].content = 'P';
+    board_set_content(board, get_board_index(board, x, y), 'P');
 }
 
-static int load_pacman_from_behavior(board_t *board, const char *behavior_path, int points) {
-    int passo = 0, row = 0, col = 0, n_moves = 0;
-    command_t moves[MAX_MOVES];
-
-    if (parse_behavior_file(behavior_path, &passo, &row, &col, moves, &n_moves) != 0) {
-        return -1;
-    }
-
+static int place_pacman(board_t *board, int points, int passo, int row, int col, const command_t *moves, int n_moves) {
     if (!is_valid_position(board, col, row)) {
         return -1;
     }
@@ -574,21 +1078,24 @@ static int load_pacman_from_behavior(board_t *board, const char *behavior_path,
         pac->moves[i] = moves[i];
     }
 
-    board->board[get_board_index(board, col, row)].content = 'P';
+    board_set_content(board, get_board_index(board, col, row), 'P');
     return 0;
 }
 
-static int load_ghost_from_behavior(board_t *board, int ghost_index, const char *behavior_path) {
-    if (ghost_index < 0 || ghost_index >= board->n_ghosts){
-        return -1;
-    }
-
+static int load_pacman_from_behavior(board_t *board, const char *behavior_path, int points) {
     int passo = 0, row = 0, col = 0, n_moves = 0;
     command_t moves[MAX_MOVES];
 
     if (parse_behavior_file(behavior_path, &passo, &row, &col, moves, &n_moves) != 0) {
         return -1;
     }
+    return place_pacman(board, points, passo, row, col, moves, n_moves);
+}
+
+static int place_ghost(board_t *board, int ghost_index, int passo, int row, int col, const command_t *moves, int n_moves) {
+    if (ghost_index < 0 || ghost_index >= board->n_ghosts){
+        return -1;
+    }
 
     if (!is_valid_position(board, col, row)) {
         return -1;
@@ -608,28 +1115,112 @@ static int load_ghost_from_behavior(board_t *board, int ghost_index, const char
         g->moves[i] = moves[i];
     }
 
-    board->board[get_board_index(board, col, row)].content = 'M';
+    board_set_content(board, get_board_index(board, col, row), 'M');
     return 0;
 }
 
-int load_level(board_t *board, int points) {
-    if (g_current_level >= g_num_levels) {
-        return -1;  /* sem mais níveis */
+static int load_ghost_from_behavior(board_t *board, int ghost_index, const char *behavior_path) {
+    int passo = 0, row = 0, col = 0, n_moves = 0;
+    command_t moves[MAX_MOVES];
+
+    if (parse_behavior_file(behavior_path, &passo, &row, &col, moves, &n_moves) != 0) {
+        return -1;
     }
+    return place_ghost(board, ghost_index, passo, row, col, moves, n_moves);
+}
 
-    const char *lvl_path = g_level_files[g_current_level];
+/* lê um nível do pack como parse_level_file lê um .lvl, sem qualquer parsing */
+static int read_pack_level(const pack_t *pack, int index, board_t *board, int *default_pac_x, int *default_pac_y) {
+    const pack_level_t *lvl = pack_level(pack, index);
+    const board_pos_t *cells = lvl ? pack_cells(pack, lvl) : NULL;
+    if (!cells) {
+        fprintf(stderr, "Bad level %d in pack\n", index);
+        return -1;
+    }
+
+    size_t n_cells = (size_t)lvl->width * lvl->height;
+    board->board = malloc(n_cells * sizeof(board_pos_t));
+    if (!board->board) {
+        perror("malloc pack board");
+        return -1;
+    }
+    // the board is written while playing, so the grid is copied out of the mapping
+    memcpy(board->board, cells, n_cells * sizeof(board_pos_t));
 
+    board->width = lvl->width;
+    board->height = lvl->height;
+    board->tempo = lvl->tempo;
+    board->n_pacmans = 1;
+    board->n_ghosts = lvl->n_ghosts;
+    board->pacmans = NULL;
+    board->ghosts = NULL;
+    board->row_blockers = NULL;
+    board->col_blockers = NULL;
+    snprintf(board->level_name, sizeof(board->level_name), "%.*s", MAX_FILENAME - 1, lvl->name);
+
+    const pack_behavior_t *pac = pack_behavior(pack, lvl->pacman);
+    snprintf(board->pacman_file, sizeof(board->pacman_file), "%.*s", MAX_FILENAME - 1, pac ? pac->name : "");
+    for (int i = 0; i < MAX_GHOSTS; i++) {
+        const pack_behavior_t *ghost = i < lvl->n_ghosts ? pack_behavior(pack, lvl->ghosts[i]) : NULL;
+        snprintf(board->ghosts_files[i], sizeof(board->ghosts_files[i]), "%.*s", MAX_FILENAME - 1, ghost ? ghost->name : "");
+    }
+
+    *default_pac_x = lvl->default_pac_x;
+    *default_pac_y = lvl->default_pac_y;
+    return 0;
+}
+
+// Same placement as the .p/.m files, from the behaviors parsed when the pack was built
+static void place_pack_entities(const pack_t *pack, int index, board_t *board, int points,
+                                int default_pac_x, int default_pac_y) {
+    const pack_level_t *lvl = pack_level(pack, index);
+    command_t moves[MAX_MOVES];
+
+    const pack_behavior_t *pac = pack_behavior(pack, lvl->pacman);
+    if (!pac || !pac->valid ||
+        place_pacman(board, points, pac->passo, pac->row, pac->col, moves, pack_behavior_moves(pac, moves)) != 0) {
+        place_default_pacman(board, points, default_pac_x, default_pac_y);
+    }
+
+    for (int i = 0; i < board->n_ghosts; ++i) {
+        const pack_behavior_t *ghost = pack_behavior(pack, lvl->ghosts[i]);
+        if (ghost && ghost->valid) {
+            place_ghost(board, i, ghost->passo, ghost->row, ghost->col, moves, pack_behavior_moves(ghost, moves));
+        }
+    }
+}
+
+/* constrói o nível 'index' do conjunto em board, sem mexer no conjunto (corre também na thread de prefetch) */
+static int build_level(const level_set_t *levels, int index, board_t *board, int points) {
     int default_pac_x = 1;
     int default_pac_y = 1;
 
-    if (parse_level_file(lvl_path, board, &default_pac_x, &default_pac_y) != 0) {
+    if (levels->pack) {
+        if (read_pack_level(levels->pack, index, board, &default_pac_x, &default_pac_y) != 0) {
+            return -1;
+        }
+    } else if (parse_level_file(levels->index.paths[index], board, &default_pac_x, &default_pac_y) != 0) {
         return -1;
     }
 
+    board->history = NULL;
+    board->dirty_cells = NULL;
+    board->n_dirty = 0;
+    board->dirty_capacity = 0;
+    board->full_redraw = 1;
+    board->occupants = NULL;
+    board->occupants_mask = 0;
+    board->row_blockers = NULL;
+    board->col_blockers = NULL;
+    board->locks = NULL;
+    board->chase = NULL;
+    board->levels = (level_set_t *)levels;
+    board->ghosts = NULL;
     board->n_pacmans = 1;
     board->pacmans = calloc(board->n_pacmans, sizeof(pacman_t));
     if (!board->pacmans) {
         perror("calloc pacmans");
+        unload_level(board);
         return -1;
     }
 
@@ -637,16 +1228,16 @@ int load_level(board_t *board, int points) {
         board->ghosts = calloc(board->n_ghosts, sizeof(ghost_t));
         if (!board->ghosts) {
             perror("calloc ghosts");
-            free(board->pacmans);
+            unload_level(board);
             return -1;
         }
-    } else {
-        board->ghosts = NULL;
     }
 
-    if (board->pacman_file[0] != '\0') {
+    if (levels->pack) {
+        place_pack_entities(levels->pack, index, board, points, default_pac_x, default_pac_y);
+    } else if (board->pacman_file[0] != '\0') {
         char fullpath[512];
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", g_base_dir, board->pacman_file);
+        snprintf(fullpath, sizeof(fullpath), "%s/%s", levels->base_dir, board->pacman_file);
         if (load_pacman_from_behavior(board, fullpath, points) != 0) {
             place_default_pacman(board, points, default_pac_x, default_pac_y);
         }
@@ -654,37 +1245,337 @@ int load_level(board_t *board, int points) {
         place_default_pacman(board, points, default_pac_x, default_pac_y);
     }
 
-    for (int i = 0; i < board->n_ghosts; ++i) {
+    for (int i = 0; !levels->pack && i < board->n_ghosts; ++i) {
         char fullpath[512];
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", g_base_dir, board->ghosts_files[i]);
+        snprintf(fullpath, sizeof(fullpath), "%s/%s", levels->base_dir, board->ghosts_files[i]);
         load_ghost_from_behavior(board, i, fullpath);
     }
 
-    g_current_level++;
+    if (board_index_entities(board) != 0 || board_index_blockers(board) != 0) {
+        unload_level(board);
+        return -1;
+    }
     return 0;
 }
 
+static void *prefetch_thread(void *arg) {
+    level_prefetch_t *pf = arg;
+    pf->result = build_level(pf->levels, pf->index, &pf->board, 0);
+    return NULL;
+}
+
+int level_set_prefetch(level_set_t *levels) {
+    discard_prefetch(levels);
+    if (levels->current >= levels->n_levels) {
+        return -1;
+    }
+
+    level_prefetch_t *pf = calloc(1, sizeof(level_prefetch_t));
+    if (!pf) {
+        perror("calloc prefetch");
+        return -1;
+    }
+    pf->levels = levels;
+    pf->index = levels->current;
+    if (pthread_create(&pf->thread, NULL, prefetch_thread, pf) != 0) {
+        perror("pthread_create prefetch");
+        free(pf);
+        return -1;
+    }
+    levels->prefetch = pf;
+    return 0;
+}
+
+int level_set_load(level_set_t *levels, board_t *board, int points) {
+    if (levels->current >= levels->n_levels) {
+        discard_prefetch(levels);
+        return -1;  /* sem mais níveis */
+    }
+
+    level_prefetch_t *pf = join_prefetch(levels);
+    if (pf && pf->result == 0 && pf->index == levels->current) {
+        // já construído em segundo plano, só falta trocar e dar os pontos
+        *board = pf->board;
+        board->pacmans[0].points = points;
+        free(pf);
+    } else {
+        // sem prefetch, ou para outro nível (um quicksave restaurado mexe no cursor)
+        free_prefetch(pf);
+        if (build_level(levels, levels->current, board, points) != 0) {
+            return -1;
+        }
+    }
+
+    // every entity gets its own stream, from the session seed and the level number only
+    uint64_t level_seed = rng_level_seed(levels->seed, levels->current);
+    for (int i = 0; i < board->n_ghosts; i++) {
+        rng_seed(&board->ghosts[i].rng, level_seed, i);
+    }
+    for (int i = 0; i < board->n_pacmans; i++) {
+        rng_seed(&board->pacmans[i].rng, level_seed, MAX_GHOSTS + i);
+    }
+
+    levels->current++;
+    return 0;
+}
+
+void seed_levels(unsigned int seed) {
+    level_set_seed(&g_levels, seed);
+}
+
+int load_level(board_t *board, int points) {
+    return level_set_load(&g_levels, board, points);
+}
+
+int prefetch_level(void) {
+    return level_set_prefetch(&g_levels);
+}
+
 void unload_level(board_t * board) {
     free(board->board);
+    board->board = NULL;
     free(board->pacmans);
+    board->pacmans = NULL;
     free(board->ghosts);
+    board->ghosts = NULL;
+    free(board->dirty_cells);
+    board->dirty_cells = NULL;
+    free(board->occupants);
+    board->occupants = NULL;
+    free(board->row_blockers);
+    board->row_blockers = NULL;
+    free(board->col_blockers);
+    board->col_blockers = NULL;
+    free_chase(board);
+}
+
+void board_set_blocker(board_t *board, int index, int blocked) {
+    int x = index % board->width;
+    int y = index / board->width;
+    uint64_t *row_word = &board->row_blockers[(size_t)y * row_words(board) + x / 64];
+    uint64_t *col_word = &board->col_blockers[(size_t)x * col_words(board) + y / 64];
+
+    if (blocked) {
+        *row_word |= 1ULL << (x % 64);
+        *col_word |= 1ULL << (y % 64);
+    } else {
+        *row_word &= ~(1ULL << (x % 64));
+        *col_word &= ~(1ULL << (y % 64));
+    }
+}
+
+int board_index_blockers(board_t *board) {
+    size_t n_row = (size_t)board->height * row_words(board);
+    size_t n_col = (size_t)board->width * col_words(board);
+
+    free(board->row_blockers);
+    free(board->col_blockers);
+    board->row_blockers = calloc(n_row, sizeof(uint64_t));
+    board->col_blockers = calloc(n_col, sizeof(uint64_t));
+    if (!board->row_blockers || !board->col_blockers) {
+        perror("calloc blockers");
+        free(board->row_blockers);
+        free(board->col_blockers);
+        board->row_blockers = NULL;
+        board->col_blockers = NULL;
+        return -1;
+    }
+
+    for (int index = 0; index < board->width * board->height; index++) {
+        if ((board->board[index] & CELL_OCCUPANT_MASK) != CELL_EMPTY) {
+            board_set_blocker(board, index, 1);
+        }
+    }
+    return 0;
+}
+
+int board_ghost_at(const board_t *board, int x, int y) {
+    int entity = occupant_find(board, get_board_index(board, x, y));
+    return entity >= 0 ? entity : -1;
+}
+
+int board_pacman_at(const board_t *board, int x, int y) {
+    int entity = occupant_find(board, get_board_index(board, x, y));
+    return (entity < 0 && entity != INT_MIN) ? -(entity + 1) : -1;
+}
+
+int board_index_entities(board_t *board) {
+    int needed = 4 * (board->n_pacmans + board->n_ghosts);
+    int slots = 16;
+    while (slots < needed) slots *= 2;
+
+    if (!board->occupants || board->occupants_mask + 1 != slots) {
+        occupant_t *tmp = realloc(board->occupants, (size_t)slots * sizeof(occupant_t));
+        if (!tmp) {
+            perror("realloc occupants");
+            return -1;
+        }
+        board->occupants = tmp;
+        board->occupants_mask = slots - 1;
+    }
+    for (int i = 0; i < slots; i++) {
+        board->occupants[i].cell = -1;
+    }
+
+    // only entities that actually made it onto the board (a bad POS leaves them out)
+    for (int p = 0; p < board->n_pacmans; p++) {
+        int index = get_board_index(board, board->pacmans[p].pos_x, board->pacmans[p].pos_y);
+        if (board_cell_content(board, index) == 'P') occupant_set(board, index, -(p + 1));
+    }
+    for (int g = 0; g < board->n_ghosts; g++) {
+        int index = get_board_index(board, board->ghosts[g].pos_x, board->ghosts[g].pos_y);
+        if (board_cell_content(board, index) == 'M') occupant_set(board, index, g);
+    }
+    return 0;
+}
+
+void board_mark_dirty(board_t *board, int index) {
+    if (board->full_redraw) {
+        return; // everything gets repainted anyway
+    }
+
+    // past a quarter of the board a full repaint is cheaper than the list
+    if (board->n_dirty == board->dirty_capacity) {
+        int capacity = board->dirty_capacity ? board->dirty_capacity * 2 : 64;
+        int *tmp = NULL;
+        if (capacity <= 64 || capacity <= board->width * board->height / 4) {
+            tmp = realloc(board->dirty_cells, (size_t)capacity * sizeof(int));
+        }
+        if (!tmp) {
+            board->full_redraw = 1;
+            return;
+        }
+        board->dirty_cells = tmp;
+        board->dirty_capacity = capacity;
+    }
+    board->dirty_cells[board->n_dirty++] = index;
 }
 
-void open_debug_file(char *filename) {
-    debugfile = fopen(filename, "w");
+void board_mark_all_dirty(board_t *board) {
+    board->full_redraw = 1;
 }
 
-void close_debug_file() {
-    fclose(debugfile);
+void board_clear_dirty(board_t *board) {
+    board->n_dirty = 0;
+    board->full_redraw = 0;
 }
 
-void debug(const char * format, ...) {
-    va_list args;
-    va_start(args, format);
-    vfprintf(debugfile, format, args);
-    va_end(args);
+// Grows *buf to hold at least 'count' elements, keeping the old buffer if it is big enough
+static int reserve(void **buf, int *capacity, int count, size_t elem_size) {
+    if (count <= *capacity) {
+        return 0;
+    }
+    void *tmp = realloc(*buf, (size_t)count * elem_size);
+    if (!tmp) {
+        perror("realloc snapshot");
+        return -1;
+    }
+    *buf = tmp;
+    *capacity = count;
+    return 0;
+}
+
+// Copies the fields that make up the game state; arrays, indexes and render/recording state stay put
+static void copy_level_state(board_t *dst, const board_t *src) {
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->n_pacmans = src->n_pacmans;
+    dst->n_ghosts = src->n_ghosts;
+    memcpy(dst->level_name, src->level_name, sizeof(dst->level_name));
+    memcpy(dst->pacman_file, src->pacman_file, sizeof(dst->pacman_file));
+    memcpy(dst->ghosts_files, src->ghosts_files, sizeof(dst->ghosts_files));
+    dst->tempo = src->tempo;
+}
+
+int board_snapshot(const board_t *board, board_snapshot_t *snap) {
+    board_t *copy = &snap->board;
+    int n_cells = board->width * board->height;
+
+    if (reserve((void **)&copy->board, &snap->cells_capacity, n_cells, sizeof(board_pos_t)) != 0 ||
+        reserve((void **)&copy->pacmans, &snap->pacmans_capacity, board->n_pacmans, sizeof(pacman_t)) != 0 ||
+        reserve((void **)&copy->ghosts, &snap->ghosts_capacity, board->n_ghosts, sizeof(ghost_t)) != 0) {
+        return -1;
+    }
+
+    // indexes and render state are not part of a save, they are rebuilt on restore
+    copy_level_state(copy, board);
+    memcpy(copy->board, board->board, (size_t)n_cells * sizeof(board_pos_t));
+    memcpy(copy->pacmans, board->pacmans, (size_t)board->n_pacmans * sizeof(pacman_t));
+    if (board->n_ghosts > 0) {
+        memcpy(copy->ghosts, board->ghosts, (size_t)board->n_ghosts * sizeof(ghost_t));
+    }
+
+    snap->level_cursor = board->levels ? board->levels->current : 0;
+    snap->saved = 1;
+    return 0;
+}
+
+int board_restore(board_t *board, const board_snapshot_t *snap) {
+    if (!snap->saved) {
+        return -1;
+    }
+
+    const board_t *saved = &snap->board;
+    int n_cells = saved->width * saved->height;
+
+    // the saved level may have other dimensions than the current one
+    if (n_cells != board->width * board->height) {
+        board_pos_t *cells = realloc(board->board, (size_t)n_cells * sizeof(board_pos_t));
+        if (!cells) {
+            perror("realloc restore board");
+            return -1;
+        }
+        board->board = cells;
+    }
+    if (saved->n_pacmans != board->n_pacmans) {
+        pacman_t *pacmans = realloc(board->pacmans, (size_t)saved->n_pacmans * sizeof(pacman_t));
+        if (!pacmans) {
+            perror("realloc restore pacmans");
+            return -1;
+        }
+        board->pacmans = pacmans;
+    }
+    if (saved->n_ghosts != board->n_ghosts) {
+        ghost_t *ghosts = NULL;
+        if (saved->n_ghosts > 0) {
+            ghosts = realloc(board->ghosts, (size_t)saved->n_ghosts * sizeof(ghost_t));
+            if (!ghosts) {
+                perror("realloc restore ghosts");
+                return -1;
+            }
+        } else {
+            free(board->ghosts);
+        }
+        board->ghosts = ghosts;
+    }
+
+    copy_level_state(board, saved);
+    board->n_dirty = 0;
+    board->full_redraw = 1;
+
+    memcpy(board->board, saved->board, (size_t)n_cells * sizeof(board_pos_t));
+    memcpy(board->pacmans, saved->pacmans, (size_t)saved->n_pacmans * sizeof(pacman_t));
+    if (saved->n_ghosts > 0) {
+        memcpy(board->ghosts, saved->ghosts, (size_t)saved->n_ghosts * sizeof(ghost_t));
+    }
+
+    if (board->levels) {
+        board->levels->current = snap->level_cursor;
+    }
+    if (board->chase) {
+        board->chase->root = -1;    // walls and pacman may be others now
+    }
+    if (board_index_entities(board) != 0) {
+        return -1;
+    }
+    return board_index_blockers(board);
+}
 
-    fflush(debugfile);
+void board_snapshot_free(board_snapshot_t *snap) {
+    free(snap->board.board);
+    free(snap->board.pacmans);
+    free(snap->board.ghosts);
+    memset(snap, 0, sizeof(*snap));
 }
 
 void print_board(board_t *board) {
@@ -718,7 +1609,7 @@ void print_board(board_t *board) {
         for (int x = 0; x < board->width; x++) {
             int idx = get_board_index(board, x, y);
             if (offset < sizeof(buffer) - 2) {
-                buffer[offset++] = board->board[idx].content;
+                buffer[offset++] = board_cell_content(board, idx);
             }
         }
         if (offset < sizeof(buffer) - 2) {
@@ -0,0 +1,128 @@
+#include "clock.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#define NS_PER_SEC 1000000000ULL
+#define MIN_PERIOD_NS 1000000ULL        // TEMPO 0 runs at 1 ms instead of flat out
+
+static struct timespec to_timespec(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns / NS_PER_SEC);
+    ts.tv_nsec = (long)(ns % NS_PER_SEC);
+    return ts;
+}
+
+uint64_t clock_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+void clock_init(game_clock_t* clk) {
+    memset(clk, 0, sizeof(*clk));
+    clk->period_ns = MIN_PERIOD_NS;
+}
+
+void clock_start(game_clock_t* clk, int tempo) {
+    uint64_t period = (uint64_t)(tempo > 0 ? tempo : 0) * 1000000ULL;
+    clk->period_ns = period > MIN_PERIOD_NS ? period : MIN_PERIOD_NS;
+    clk->next_ns = clock_now_ns() + clk->period_ns;
+}
+
+int clock_arm(const game_clock_t* clk, int timer_fd) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value = to_timespec(clk->next_ns);
+    return timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+int clock_due(game_clock_t* clk) {
+    uint64_t now = clock_now_ns();
+    if (now < clk->next_ns) {
+        return 0;
+    }
+    clock_record(clk, CLOCK_LATE, now - clk->next_ns);
+
+    // every deadline that already passed, the next one is always in the future
+    uint64_t missed = (now - clk->next_ns) / clk->period_ns + 1;
+    clk->next_ns += missed * clk->period_ns;
+
+    int due = missed > CLOCK_MAX_CATCHUP ? CLOCK_MAX_CATCHUP : (int)missed;
+    clk->dropped += missed - (uint64_t)due;
+    clk->caught_up += (unsigned long)due - 1;
+    clk->ticks += (unsigned long)due;
+    return due;
+}
+
+void clock_hurry(game_clock_t* clk) {
+    uint64_t earliest = clk->next_ns - clk->period_ns / 2;
+    uint64_t now = clock_now_ns();
+    uint64_t next = now > earliest ? now : earliest;
+    if (next < clk->next_ns) {
+        clk->next_ns = next;
+    }
+}
+
+void clock_sleep_ticks(game_clock_t* clk, int ticks) {
+    if (ticks <= 0) {
+        return;
+    }
+    uint64_t until = clk->next_ns + (uint64_t)(ticks - 1) * clk->period_ns;
+    struct timespec ts = to_timespec(until);
+    // the deadline is absolute, a signal (SIGWINCH) just sleeps again towards it
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+    clk->next_ns = until + clk->period_ns;
+}
+
+void clock_record(game_clock_t* clk, clock_hist_id_t hist, uint64_t ns) {
+    clock_hist_t* h = &clk->hists[hist];
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while (us > 1 && bucket < CLOCK_HIST_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    h->buckets[bucket]++;
+    h->count++;
+    h->total_ns += ns;
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+}
+
+// Upper bound (us) of the bucket holding the given fraction of the samples
+static unsigned long percentile_us(const clock_hist_t* h, double fraction) {
+    unsigned long wanted = (unsigned long)(fraction * (double)h->count);
+    unsigned long seen = 0;
+    for (int i = 0; i < CLOCK_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > wanted) {
+            return 2UL << i;
+        }
+    }
+    return 2UL << (CLOCK_HIST_BUCKETS - 1);
+}
+
+void clock_report(const game_clock_t* clk, FILE* out) {
+    static const char* names[CLOCK_N_HISTS] = {"simulate", "render", "sleep", "late"};
+
+    fprintf(out, "ticks=%lu caught_up=%lu dropped=%lu\n", clk->ticks, clk->caught_up, clk->dropped);
+    for (int i = 0; i < CLOCK_N_HISTS; i++) {
+        const clock_hist_t* h = &clk->hists[i];
+        if (h->count == 0) {
+            fprintf(out, "%-8s count=0\n", names[i]);
+            continue;
+        }
+        fprintf(out, "%-8s count=%lu mean_us=%.1f p50_us<%lu p99_us<%lu max_us=%.1f\n",
+                names[i], h->count, (double)h->total_ns / (double)h->count / 1000.0,
+                percentile_us(h, 0.50), percentile_us(h, 0.99), (double)h->max_ns / 1000.0);
+        for (int b = 0; b < CLOCK_HIST_BUCKETS; b++) {
+            if (h->buckets[b]) {
+                fprintf(out, "    <%8lu us %lu\n", 2UL << b, h->buckets[b]);
+            }
+        }
+    }
+}
@@ -1,9 +1,26 @@
 #include "display.h"
 #include "board.h"
 #include <stdlib.h>
+#include <stdio.h>
 #include <ctype.h>
 
 
+static void init_colors() {
+    // Enable color if terminal supports it
+    if (has_colors()) {
+        start_color();
+
+        // Define color pairs (foreground, background)
+        init_pair(1, COLOR_YELLOW, COLOR_BLACK);  // Pacman
+        init_pair(2, COLOR_RED, COLOR_BLACK);     // Ghosts
+        init_pair(3, COLOR_BLUE, COLOR_BLACK);    // Walls
+        init_pair(4, COLOR_WHITE, COLOR_BLACK);   // Points/dots
+        init_pair(5, COLOR_GREEN, COLOR_BLACK);   // UI elements
+        init_pair(6, COLOR_MAGENTA, COLOR_BLACK); // Extra
+        init_pair(7, COLOR_CYAN, COLOR_BLACK);    // Extra
+    }
+}
+
 int terminal_init() {
     // Initialize ncurses mode
     initscr();
@@ -23,19 +40,7 @@ int terminal_init() {
     // Hide the cursor
     curs_set(0);
 
-    // Enable color if terminal supports it
-    if (has_colors()) {
-        start_color();
-
-        // Define color pairs (foreground, background)
-        init_pair(1, COLOR_YELLOW, COLOR_BLACK);  // Pacman
-        init_pair(2, COLOR_RED, COLOR_BLACK);     // Ghosts
-        init_pair(3, COLOR_BLUE, COLOR_BLACK);    // Walls
-        init_pair(4, COLOR_WHITE, COLOR_BLACK);   // Points/dots
-        init_pair(5, COLOR_GREEN, COLOR_BLACK);   // UI elements
-        init_pair(6, COLOR_MAGENTA, COLOR_BLACK); // Extra
-        init_pair(7, COLOR_CYAN, COLOR_BLACK);    // Extra
-    }
+    init_colors();
 
     // Clear the screen
     clear();
@@ -43,97 +48,182 @@ int terminal_init() {
     return 0;
 }
 
+int terminal_init_offscreen(int rows, int cols) {
+    FILE* out = fopen("/dev/null", "w");
+    FILE* in = fopen("/dev/null", "r");
+    if (!out || !in) {
+        perror("fopen /dev/null");
+        if (out) fclose(out);
+        if (in) fclose(in);
+        return -1;
+    }
 
-void draw_board(board_t* board, int mode) {
-    // Clear the screen before redrawing
+    const char* term = getenv("TERM");
+    SCREEN* screen = newterm((char*)(term && *term ? term : "xterm"), out, in);
+    if (!screen) {
+        fclose(out);
+        fclose(in);
+        return -1;
+    }
+    set_term(screen);
+    init_colors();
+    resizeterm(rows, cols);
     clear();
+    return 0;
+}
 
-    // Draw the border/title
-    attron(COLOR_PAIR(5));
-    mvprintw(0, 0, "=== PACMAN GAME ===");
-    switch(mode) {
-    case DRAW_GAME_OVER:
-        mvprintw(1, 0, " GAME OVER ");
-        break;
-
-    case DRAW_WIN:
-        mvprintw(1, 0, " VICTORY ");
-        break;
-
-    case DRAW_MENU:
-        mvprintw(1, 0, "Level: %s | Use W/A/S/D to move | Q to quit | G to quicksave ", board->level_name);
-        break;
-    }
 
+// Starting row for the game board (leave space for UI)
+#define START_ROW 3
+
+static int last_mode = -1;
+
+// Camera: part of the board that fits the terminal, kept around the pacman
+static int cam_x = 0, cam_y = 0;        // board cell shown at the top-left corner
+static int view_w = 0, view_h = 0;      // cells shown in each direction
+static int last_lines = -1, last_cols = -1;
+
+static inline int clamp(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// Moves the camera only when the pacman gets within a quarter of the view from an edge,
+// returns 1 if what is on screen changed
+static int follow_pacman(board_t* board) {
+    int old_x = cam_x, old_y = cam_y, old_w = view_w, old_h = view_h;
+
+    // title rows above the board, points line below it
+    view_w = clamp(COLS, 1, board->width);
+    view_h = clamp(LINES - START_ROW - 2, 1, board->height);
+
+    pacman_t* pac = &board->pacmans[0];
+    int margin_x = view_w / 4;
+    int margin_y = view_h / 4;
+
+    if (pac->pos_x < cam_x + margin_x) cam_x = pac->pos_x - margin_x;
+    if (pac->pos_x >= cam_x + view_w - margin_x) cam_x = pac->pos_x - view_w + margin_x + 1;
+    if (pac->pos_y < cam_y + margin_y) cam_y = pac->pos_y - margin_y;
+    if (pac->pos_y >= cam_y + view_h - margin_y) cam_y = pac->pos_y - view_h + margin_y + 1;
+
+    cam_x = clamp(cam_x, 0, board->width - view_w);
+    cam_y = clamp(cam_y, 0, board->height - view_h);
+
+    return cam_x != old_x || cam_y != old_y || view_w != old_w || view_h != old_h;
+}
+
+static inline int in_view(int x, int y) {
+    return x >= cam_x && x < cam_x + view_w && y >= cam_y && y < cam_y + view_h;
+}
 
-    // Starting row for the game board (leave space for UI)
-    int start_row = 3;
+static void draw_cell(board_t* board, int x, int y) {
+    int index = y * board->width + x;
+    char ch = board_cell_content(board, index);
+    int ghost_charged = 0;
 
-    // Draw the board
-    for (int y = 0; y < board->height; y++) {
-        for (int x = 0; x < board->width; x++) {
-            int index = y * board->width + x;
-            char ch = board->board[index].content;
-            int ghost_charged = 0;
+    if (ch == 'M') {
+        int g = board_ghost_at(board, x, y);
+        if (g >= 0 && board->ghosts[g].charged)
+            ghost_charged = 1;
+    }
 
-            for (int g = 0; g < board->n_ghosts; g++) {
-                ghost_t* ghost = &board->ghosts[g];
-                if (ghost->pos_x == x && ghost->pos_y == y) {
-                    if (ghost->charged)
-                        ghost_charged = 1;
-                    break;
-                }
+    // Move cursor to position
+    move(START_ROW + y - cam_y, x - cam_x);
+
+    // Draw with appropriate color
+    switch (ch) {
+        case 'W': // Wall
+            attron(COLOR_PAIR(3));
+            addch('#');
+            attroff(COLOR_PAIR(3));
+            break;
+
+        case 'P': // Pacman
+            attron(COLOR_PAIR(1) | A_BOLD);
+            addch('C');
+            attroff(COLOR_PAIR(1) | A_BOLD);
+            break;
+
+        case 'M': // Monster/Ghost
+            attron((COLOR_PAIR(2) | A_BOLD) | ((ghost_charged) ? (A_DIM) : (0)));
+            addch('M');
+            attroff((COLOR_PAIR(2) | A_BOLD) | ((ghost_charged) ? (A_DIM) : (0)));
+            break;
+
+        case ' ': // Empty space
+            if (board_has_portal(board, index)) {
+                attron(COLOR_PAIR(6));
+                addch('@');
+                attroff(COLOR_PAIR(6));
+            }
+            else if (board_has_dot(board, index)) {
+                attron(COLOR_PAIR(4));
+                addch('.');
+                attroff(COLOR_PAIR(4));
             }
+            else
+                addch(' ');
+            break;
+
+        default:
+            addch(ch);
+            break;
+    }
+}
 
-            // Move cursor to position
-            move(start_row + y, x);
-
-            // Draw with appropriate color
-            switch (ch) {
-                case 'W': // Wall
-                    attron(COLOR_PAIR(3));
-                    addch('#');
-                    attroff(COLOR_PAIR(3));
-                    break;
-
-                case 'P': // Pacman
-                    attron(COLOR_PAIR(1) | A_BOLD);
-                    addch('C');
-                    attroff(COLOR_PAIR(1) | A_BOLD);
-                    break;
-
-                case 'M': // Monster/Ghost
-                    attron((COLOR_PAIR(2) | A_BOLD) | ((ghost_charged) ? (A_DIM) : (0)));
-                    addch('M');
-                    attroff((COLOR_PAIR(2) | A_BOLD) | ((ghost_charged) ? (A_DIM) : (0)));
-                    break;
-
-                case ' ': // Empty space
-                    if (board->board[index].has_portal) {
-                        attron(COLOR_PAIR(6));
-                        addch('@');
-                        attroff(COLOR_PAIR(6));
-                    }
-                    else if (board->board[index].has_dot) {
-                        attron(COLOR_PAIR(4));
-                        addch('.');
-                        attroff(COLOR_PAIR(4));
-                    }
-                    else
-                        addch(' ');
-                    break;
-
-                default:
-                    addch(ch);
-                    break;
+void draw_board(board_t* board, int mode) {
+    // a resize moves everything on screen
+    int resized = (LINES != last_lines || COLS != last_cols);
+    last_lines = LINES;
+    last_cols = COLS;
+    int moved = follow_pacman(board);
+
+    // Only a new mode, a new level, a restore or a camera move repaint the whole view
+    if (board->full_redraw || mode != last_mode || moved || resized) {
+        erase();
+
+        // Draw the border/title
+        attron(COLOR_PAIR(5));
+        mvprintw(0, 0, "=== PACMAN GAME ===");
+        switch(mode) {
+        case DRAW_GAME_OVER:
+            mvprintw(1, 0, " GAME OVER ");
+            break;
+
+        case DRAW_WIN:
+            mvprintw(1, 0, " VICTORY ");
+            break;
+
+        case DRAW_MENU:
+            mvprintw(1, 0, "Level: %s | Use W/A/S/D to move | Q to quit | G to quicksave | B to rewind ", board->level_name);
+            break;
+        }
+        attroff(COLOR_PAIR(5));
+
+        // only the cells inside the view are visited, whatever the size of the level
+        for (int y = cam_y; y < cam_y + view_h; y++) {
+            for (int x = cam_x; x < cam_x + view_w; x++) {
+                draw_cell(board, x, y);
+            }
+        }
+        last_mode = mode;
+    } else {
+        // Repaint just the visible cells the last ticks wrote
+        for (int i = 0; i < board->n_dirty; i++) {
+            int index = board->dirty_cells[i];
+            int x = index % board->width;
+            int y = index / board->width;
+            if (in_view(x, y)) {
+                draw_cell(board, x, y);
             }
         }
     }
+    board_clear_dirty(board);
 
     // Draw score/status at the bottom
     attron(COLOR_PAIR(5));
-    mvprintw(start_row + board->height + 1, 0, "Points: %d",
+    mvprintw(START_ROW + view_h + 1, 0, "Points: %d",
              board->pacmans[0].points); // Assuming first pacman for now
+    clrtoeol();
     attroff(COLOR_PAIR(5));
 }
 
@@ -158,6 +248,11 @@ char get_input() {
         return '\0'; // No input
     }
 
+    // ncurses already resized stdscr, the next draw_board fits the view to LINES/COLS
+    if (ch == KEY_RESIZE) {
+        return '\0';
+    }
+
     ch = toupper((char)ch);
 
     switch ((char)ch) {
@@ -167,6 +262,7 @@ char get_input() {
         case 'D':
         case 'Q':
         case 'G':
+        case 'B':
 
             return (char)ch;
         
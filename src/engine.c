@@ -0,0 +1,116 @@
+#include "engine.h"
+#include "board.h"
+#include <string.h>
+
+int engine_init(engine_t* engine, const char* level_dir, int ghost_workers, sched_mode_t sched_mode) {
+    memset(engine, 0, sizeof(*engine));
+    engine->status = ENGINE_NO_LEVEL;
+    engine->ghost_workers = ghost_workers;
+    engine->sched_mode = sched_mode;
+
+    if (level_set_init(&engine->levels, level_dir) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void engine_seed(engine_t* engine, unsigned int seed) {
+    level_set_seed(&engine->levels, seed);
+}
+
+int engine_next_level(engine_t* engine) {
+    if (engine->loaded) {
+        engine->points = engine->board.pacmans[0].points;
+        scheduler_destroy(&engine->sched);
+        unload_level(&engine->board);
+        engine->loaded = 0;
+    }
+
+    engine->tick = 0;
+    engine->status = ENGINE_NO_LEVEL;
+
+    if (level_set_load(&engine->levels, &engine->board, engine->points) != 0) {
+        return -1;
+    }
+
+    if (scheduler_init(&engine->sched, &engine->board, engine->ghost_workers, engine->sched_mode) != 0) {
+        unload_level(&engine->board);
+        return -1;
+    }
+
+    engine->loaded = 1;
+    engine->level++;
+    engine->status = ENGINE_RUNNING;
+    return 0;
+}
+
+int engine_load_level(engine_t* engine, int index) {
+    if (index < 0 || index >= engine->levels.n_levels) {
+        return -1;
+    }
+    engine->levels.current = index;
+    return engine_next_level(engine);
+}
+
+int engine_restore(engine_t* engine, const board_snapshot_t* snap) {
+    if (!engine->loaded || board_restore(&engine->board, snap) != 0) {
+        return -1;
+    }
+    engine->status = ENGINE_RUNNING;
+    return 0;
+}
+
+engine_status_t engine_step(engine_t* engine, char input) {
+    if (!engine->loaded) {
+        return ENGINE_NO_LEVEL;
+    }
+    if (engine->status != ENGINE_RUNNING) {
+        return engine->status;
+    }
+
+    board_t* board = &engine->board;
+    pacman_t* pacman = &board->pacmans[0];
+    engine->tick++;
+
+    // the pacman command is picked the same way play_board does it
+    command_t c;
+    command_t* play = NULL;
+    if (pacman->n_moves == 0) {
+        if (input != '\0') {
+            c.command = input;
+            c.turns = 1;
+            c.turns_left = 1;
+            play = &c;
+        }
+    } else {
+        play = &pacman->moves[pacman->current_move % pacman->n_moves];
+    }
+
+    if (scheduler_tick(&engine->sched, play) == REACHED_PORTAL) {
+        engine->status = ENGINE_LEVEL_DONE;
+        return engine->status;
+    }
+
+    if (!pacman->alive) {
+        engine->status = ENGINE_PACMAN_DEAD;
+    }
+    return engine->status;
+}
+
+const board_t* engine_board(const engine_t* engine) {
+    return engine->loaded ? &engine->board : NULL;
+}
+
+int engine_points(const engine_t* engine) {
+    return engine->loaded ? engine->board.pacmans[0].points : engine->points;
+}
+
+void engine_destroy(engine_t* engine) {
+    if (engine->loaded) {
+        scheduler_destroy(&engine->sched);
+        unload_level(&engine->board);
+        engine->loaded = 0;
+    }
+    level_set_free(&engine->levels);
+    engine->status = ENGINE_NO_LEVEL;
+}
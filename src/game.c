@@ -1,73 +1,204 @@
 #include "board.h"
 #include "display.h"
 #include "parser.h"
+#include "scheduler.h"
+#include "history.h"
+#include "trace.h"
+#include "clock.h"
+#include "metrics.h"
+#include "lockprof.h"
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
-#include <sys/wait.h>
-#include <sys/types.h>
 #include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
 
 #define CONTINUE_PLAY 0
 #define NEXT_LEVEL 1
 #define QUIT_GAME 2
 #define LOAD_BACKUP 3
 #define CREATE_BACKUP 4
+#define REWIND 5
 
-static int backup = 0;
+#define HISTORY_TICKS 1024          // ticks guardados para o rewind
+#define HISTORY_KEYFRAME_INTERVAL 64
+#define REWIND_MS 1000              // quanto tempo de jogo a tecla B recua
+
+#define KEY_QUEUE 32                // teclas de movimento à espera do seu tick
 
-// sincronização e threads dos fantasmas
-static pthread_rwlock_t board_lock; 
-static int ghosts_should_run = 0;     // 1 enquanto as threads devem correr
-static board_t *global_board = NULL;  // ponteiro para o tabuleiro atual
+static int backup = 0;
+static board_snapshot_t quicksave;    // estado guardado com a tecla G
+static history_t rewind_history;      // últimos ticks do nível, para a tecla B
+static int history_enabled = 0;
+
+// sincronização do tabuleiro
+static prof_rwlock_t board_lock; 
+static scheduler_t scheduler;         // avança o pacman e os fantasmas, um tick de cada vez
+static int ghost_workers = 0;         // threads para os fantasmas de cada tick, 0 = sequencial
+static sched_mode_t sched_mode = SCHED_DIRECT; // -m intent: fantasmas planeiam em paralelo e aplicam por ordem
+
+// -r ficheiro: grava a sessão para o Pacmanist-replay
+static trace_writer_t session_trace;
+static int tracing = 0;
+
+// ciclo de eventos: o jogo só acorda com uma tecla ou com o prazo do próximo tick
+static int tick_fd = -1;              // timerfd armado no prazo absoluto do próximo tick
+static game_clock_t game_clock;       // prazos dos ticks e histogramas de tempos por tick
+static int pending_ticks = 0;         // ticks em atraso ainda por jogar, sem desenhar entre eles
+static uint64_t slept_ns = 0;         // tempo bloqueado desde o último tick
+static int show_timing = 0;           // -t: mostra os histogramas de tempos à saída
+static char key_queue[KEY_QUEUE];     // teclas de movimento, uma por tick
+static int key_head = 0, key_count = 0;
 
 void screen_refresh(board_t * game_board, int mode) {
     debug("REFRESH\n");
+    uint64_t started = metrics_clock();
     draw_board(game_board, mode);
     refresh_screen();
-    if(game_board->tempo != 0)
-        sleep_ms(game_board->tempo);       
+    metrics_count(METRIC_FRAMES, 1);
+    metrics_elapsed(METRIC_SCREEN_REFRESH_NS, started);
+}
+
+// recomeça os prazos com o tempo do nível, o primeiro tick é daqui a um tempo
+static void start_ticks(int tempo) {
+    clock_start(&game_clock, tempo);
+    clock_arm(&game_clock, tick_fd);
+    pending_ticks = 0;
+    slept_ns = 0;
+}
+
+static void queue_key(char key) {
+    if (key_count < KEY_QUEUE) {
+        key_queue[(key_head + key_count) % KEY_QUEUE] = key;
+        key_count++;
+    }
+}
+
+static char next_key(void) {
+    if (key_count == 0) {
+        return '\0';
+    }
+    char key = key_queue[key_head];
+    key_head = (key_head + 1) % KEY_QUEUE;
+    key_count--;
+    return key;
+}
+
+/* bloqueia (sem gastar CPU) até haver uma tecla ou um tick.
+Devolve logo as teclas de ação (G, Q, B), guarda as de movimento para o próximo tick
+e devolve '\0' quando é hora de jogar um tick.
+keyboard - o pacman joga com as teclas: uma tecla de movimento traz o tick para já
+(clock_hurry), sem esperar pelo prazo */
+static char wait_event(int keyboard) {
+    while (true) {
+        // o ncurses pode já ter teclas no seu buffer, lê sempre antes de bloquear
+        char key;
+        while ((key = get_input()) != '\0') {
+            if (key == 'G' || key == 'Q' || key == 'B') {
+                return key;
+            }
+            queue_key(key);
+            if (keyboard && key_count == 1) {
+                clock_hurry(&game_clock);
+                clock_arm(&game_clock, tick_fd);
+            }
+        }
+
+        struct pollfd fds[2] = {
+            {.fd = STDIN_FILENO, .events = POLLIN},
+            {.fd = tick_fd, .events = POLLIN},
+        };
+        uint64_t blocked = clock_now_ns();
+        int ready = poll(fds, 2, -1);
+        slept_ns += clock_now_ns() - blocked;
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;       // SIGWINCH, o KEY_RESIZE chega pelo get_input
+            }
+            return 'Q';
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(tick_fd, &expirations, sizeof(expirations)) != (ssize_t)sizeof(expirations)) {
+                continue;
+            }
+            // atrasado: joga os ticks em falta de seguida (até CLOCK_MAX_CATCHUP)
+            int due = clock_due(&game_clock);
+            clock_arm(&game_clock, tick_fd);
+            if (due > 0) {
+                clock_record(&game_clock, CLOCK_SLEEP, slept_ns);
+                slept_ns = 0;
+                pending_ticks = due;
+                return '\0';
+            }
+        }
+    }
 }
 
 int play_board(board_t * game_board) {
     pacman_t* pacman = &game_board->pacmans[0];
-    command_t* play;
+    command_t* play = NULL;
     command_t c; 
-    char tecla_pressionada = '\0';
 
-    if (pacman->n_moves == 0) {
-        // só em modo manual é que aceita teclado
-        tecla_pressionada = get_input();
+    char tecla_pressionada = pending_ticks > 0 ? '\0' : wait_event(pacman->n_moves == 0);
+
+    if (tecla_pressionada == 'G') {
+        return CREATE_BACKUP;
     }
 
-    if (pacman->n_moves == 0) { // if is user input
-        c.command = tecla_pressionada;
+    if (tecla_pressionada == 'Q') {
+        return QUIT_GAME;
+    }
 
-        if(c.command == '\0')
-            return CONTINUE_PLAY;
+    if (tecla_pressionada == 'B') {
+        return REWIND;
+    }
 
+    if (pacman->n_moves == 0) { // if is user input
+        c.command = next_key();
         c.turns = 1;
-        play = &c;
+        c.turns_left = 1;
+
+        // sem tecla o pacman fica parado, mas os fantasmas jogam na mesma
+        if(c.command != '\0')
+            play = &c;
     } else {// else if the moves are pre-defined in the file
         // avoid buffer overflow wrapping around with modulo of n_moves
         // this ensures that we always access a valid move for the pacman
         play = &pacman->moves[pacman->current_move%pacman->n_moves];
+        key_count = 0;      // o pacman segue o ficheiro, as setas não contam
     }
 
-    debug("KEY %c\n", play->command);
-
-    if (tecla_pressionada == 'G') {
-        return CREATE_BACKUP;
-    }
-
-    if (tecla_pressionada == 'Q') {
-        return QUIT_GAME;
+    if (play)
+        debug("KEY %c\n", play->command);
+
+    // um tick: o pacman joga primeiro, depois cada fantasma por ordem
+    pending_ticks--;
+    uint64_t started = clock_now_ns();
+    uint64_t tick_started = metrics_clock();
+    prof_rwlock_wrlock(&board_lock);
+    metrics_elapsed(METRIC_LOCK_WAIT_NS, tick_started);
+    uint64_t held = metrics_clock();
+    int result = scheduler_tick(&scheduler, play);
+    prof_rwlock_unlock(&board_lock);
+    metrics_elapsed(METRIC_LOCK_HOLD_NS, held);
+
+    if (tracing) {
+        trace_result_t outcome = result == REACHED_PORTAL ? TRACE_PORTAL :
+                                 !game_board->pacmans[0].alive ? TRACE_DEAD : TRACE_CONTINUE;
+        trace_tick(&session_trace, game_board, play == &c ? c.command : '\0', outcome);
     }
+    clock_record(&game_clock, CLOCK_SIMULATE, clock_now_ns() - started);
+    metrics_count(METRIC_TICKS, 1);
+    metrics_elapsed(METRIC_PLAY_BOARD_NS, tick_started);
 
-    int result = move_pacman(game_board, 0, play);
     if (result == REACHED_PORTAL) {
         // Next level
         return NEXT_LEVEL;
@@ -83,58 +214,81 @@ int play_board(board_t * game_board) {
     return CONTINUE_PLAY;  
 }
 
-void* ghost_worker(void* arg) {
-    int ghost_index = *(int*)arg;
-    free(arg);
-
-    while (ghosts_should_run) {
-
-        pthread_rwlock_rdlock(&board_lock);
-
-        if (global_board == NULL || ghost_index >= global_board->n_ghosts) {
-            pthread_rwlock_unlock(&board_lock);
-            break;
-        }
-
-        ghost_t* ghost = &global_board->ghosts[ghost_index];
-
-        if (ghost->n_moves == 0) {
-            pthread_rwlock_unlock(&board_lock);
-            sleep_ms(200);
-            continue;
+int main(int argc, char** argv) {
+    const char *trace_path = NULL;
+    const char *stats_path = NULL;
+    // sem -S cada sessão tem a sua seed, fica no log para se poder repetir
+    unsigned int seed = (unsigned int)time(NULL);
+    int opt;
+    while ((opt = getopt(argc, argv, "j:m:r:s:S:t")) != -1) {
+        switch (opt) {
+            case 'j':
+                ghost_workers = atoi(optarg);
+                break;
+            case 'r':
+                trace_path = optarg;
+                break;
+            case 's':
+                stats_path = optarg;
+                break;
+            case 'S':
+                seed = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                show_timing = 1;
+                break;
+            case 'm':
+                if (scheduler_parse_mode(optarg, &sched_mode) == 0) {
+                    break;
+                }
+                /* fall through */
+            default:
+                printf("Usage: %s [-j ghost_workers] [-m direct|intent] [-r trace_file] [-s stats_file] [-S seed] [-t] <level_directory>\n", argv[0]);
+                return 1;
         }
+    }
 
-        command_t* play =
-            &ghost->moves[ghost->current_move % ghost->n_moves];
-
-        pthread_rwlock_unlock(&board_lock);
-
-        pthread_rwlock_wrlock(&board_lock);
-        move_ghost(global_board, ghost_index, play);
-        pthread_rwlock_unlock(&board_lock);
+    if (optind != argc - 1) {
+        printf("Usage: %s [-j ghost_workers] [-m direct|intent] [-r trace_file] [-s stats_file] [-S seed] [-t] <level_directory>\n", argv[0]);
+        return 1;
+    }
+    const char *level_dir = argv[optind];
 
-        sleep_ms(200);
+    // com workers o modo direct move os fantasmas pela ordem em que as threads chegam, um
+    // replay (sempre sem workers) não o repete; o intent dá o mesmo jogo com qualquer -j
+    if (trace_path && ghost_workers > 0 && sched_mode == SCHED_DIRECT) {
+        printf("Note: -r with -j %d plays in -m intent, direct mode with workers can not be replayed\n", ghost_workers);
+        sched_mode = SCHED_INTENT;
     }
 
-    return NULL;
-}
+    log_open("debug.log");
 
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        printf("Usage: %s <level_directory>\n", argv[0]);
+    if (init_levels(level_dir) != 0) { 
+        printf("Error: could not load levels from directory '%s'\n", level_dir);
+        log_close();
         return 1;
     }
+    // as jogadas 'R' de cada nível vêm desta seed
+    seed_levels(seed);
+    log_info("SEED %u\n", seed);
 
-    // Random seed for any random movements
-    srand((unsigned int)time(NULL));
-
-    open_debug_file("debug.log");
+    if (trace_path) {
+        tracing = (trace_open_write(&session_trace, trace_path, level_dir, sched_mode) == 0);
+    }
 
-    if (init_levels(argv[1]) != 0) { 
-        printf("Error: could not load levels from directory '%s'\n", argv[1]);
-        close_debug_file();
+    tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tick_fd < 0) {
+        perror("timerfd_create");
+        free_levels();
+        log_close();
         return 1;
     }
+    clock_init(&game_clock);
+    if (stats_path) {
+        metrics_start(stats_path);
+    }
+
+    history_enabled = (history_init(&rewind_history, HISTORY_TICKS, HISTORY_KEYFRAME_INTERVAL) == 0);
 
     terminal_init();
 
@@ -148,125 +302,154 @@ int main(int argc, char** argv) {
             break;
         }
 
-        global_board = &game_board;
-        pthread_rwlock_init(&board_lock, NULL);
-        ghosts_should_run = 1;
-
-        // apenas uma thread por ghost
-        pthread_t ghost_threads[game_board.n_ghosts];
-        for (int i = 0; i < game_board.n_ghosts; i++) {
-            int *idx = malloc(sizeof(int));
-            if (!idx) {
-                // em caso de erro de malloc, o mais simples é parar o jogo
-                fprintf(stderr, "Erro a alocar idx do ghost %d\n", i);
-                ghosts_should_run = 0;
-                game_board.n_ghosts = i; // só dá join aos ghosts que já foram criados
-                break;
-            }
-            *idx = i;
-            pthread_create(&ghost_threads[i], NULL, ghost_worker, idx);
+        prof_rwlock_init(&board_lock, "board_lock");
+        if (scheduler_init(&scheduler, &game_board, ghost_workers, sched_mode) != 0) {
+            unload_level(&game_board);
+            break;
+        }
+        if (history_enabled) {
+            history_attach(&rewind_history, &game_board);
+        }
+        if (tracing) {
+            // estado inicial do nível, com o RNG sorteado no load
+            trace_keyframe(&session_trace, &game_board, 1);
         }
 
-        pthread_rwlock_rdlock(&board_lock);
+        prof_rwlock_rdlock(&board_lock);
         draw_board(&game_board, DRAW_MENU);
         refresh_screen();
-        pthread_rwlock_unlock(&board_lock);
+        prof_rwlock_unlock(&board_lock);
+
+        // o nível seguinte é construído enquanto este é jogado, a passagem de nível só troca o tabuleiro
+        prefetch_level();
+        start_ticks(game_board.tempo);
 
         while (true) {
             int result = play_board(&game_board);
 
             if (result == CREATE_BACKUP) {
                 if (!backup) {          // só é possível ter um estado guardado
-                    pid_t pid = fork();
-                    if (pid < 0) {
-                        // ser tivermos um erro no fork, ignoramos o backup
-                    } else if (pid > 0) {
-                        // precesso pai
+                    // cópia em memória do tabuleiro, o jogo continua sem parar
+                    prof_rwlock_rdlock(&board_lock);
+                    if (board_snapshot(&game_board, &quicksave) == 0) {
                         backup = 1;
-
-                        int status;
-                        waitpid(pid, &status, 0);
-
-                        if (WIFEXITED(status) && WEXITSTATUS(status) == 1) {
-                            end_game = true;
-                            break;
-                        }
-
-                        backup = 0;
-
-                        pthread_rwlock_rdlock(&board_lock);
-                        screen_refresh(&game_board, DRAW_MENU);
-                        pthread_rwlock_unlock(&board_lock);
-                        continue;
-                    } else {
-                        // processo filho
-                        backup = 1;  // o filho sabe que já existe backup;
-                        pthread_rwlock_destroy(&board_lock);
-                        pthread_rwlock_init(&board_lock, NULL);
-
-                        ghosts_should_run = 1;
-                        for (int i = 0; i < game_board.n_ghosts; i++) {
-                            int *idx = malloc(sizeof(int));
-                            *idx = i;
-                            pthread_create(&ghost_threads[i], NULL, ghost_worker, idx);
+                        if (tracing) {
+                            trace_event(&session_trace, TRACE_EVENT_BACKUP, 0);
                         }
                     }
+                    prof_rwlock_unlock(&board_lock);
                 }
                 // se já havia backup, a tecla G não faz nada
-                pthread_rwlock_rdlock(&board_lock);
+                prof_rwlock_rdlock(&board_lock);
                 screen_refresh(&game_board, DRAW_MENU);
-                pthread_rwlock_unlock(&board_lock);
+                prof_rwlock_unlock(&board_lock);
                 continue;
             }
 
             if (result == LOAD_BACKUP) {
-                // estamos no processo filho e se o pacman morrer, volta ao processo pai para que este retome o quicksave
-                exit(0);
+                // o pacman morreu, retoma o quicksave (pode ser de um nível anterior)
+                prof_rwlock_wrlock(&board_lock);
+                board_restore(&game_board, &quicksave);
+                if (history_enabled) {
+                    // o histórico não liga com o estado restaurado, recomeça daqui
+                    history_attach(&rewind_history, &game_board);
+                }
+                prof_rwlock_unlock(&board_lock);
+                backup = 0;
+                if (tracing) {
+                    trace_event(&session_trace, TRACE_EVENT_RESTORE, 0);
+                    trace_keyframe(&session_trace, &game_board, 1);
+                }
+                start_ticks(game_board.tempo);      // o quicksave pode ser de um nível com outro tempo
+
+                prof_rwlock_rdlock(&board_lock);
+                screen_refresh(&game_board, DRAW_MENU);
+                prof_rwlock_unlock(&board_lock);
+                continue;
+            }
+
+            if (result == REWIND) {
+                if (history_enabled) {
+                    int tempo = game_board.tempo > 0 ? game_board.tempo : 1;
+                    unsigned long ticks = REWIND_MS / tempo;
+                    unsigned long latest = history_latest_tick(&rewind_history);
+                    unsigned long oldest = history_oldest_tick(&rewind_history);
+                    unsigned long target = latest > oldest + ticks ? latest - ticks : oldest;
+
+                    prof_rwlock_wrlock(&board_lock);
+                    history_rewind(&rewind_history, &game_board, target);
+                    prof_rwlock_unlock(&board_lock);
+                    if (tracing) {
+                        trace_event(&session_trace, TRACE_EVENT_REWIND, target);
+                        trace_keyframe(&session_trace, &game_board, 1);
+                    }
+                }
+                prof_rwlock_rdlock(&board_lock);
+                screen_refresh(&game_board, DRAW_MENU);
+                prof_rwlock_unlock(&board_lock);
+                continue;
             }
 
             if (result == NEXT_LEVEL) {
-                pthread_rwlock_rdlock(&board_lock);
+                prof_rwlock_rdlock(&board_lock);
                 screen_refresh(&game_board, DRAW_WIN);
-                pthread_rwlock_unlock(&board_lock);
-                sleep_ms(game_board.tempo);
+                prof_rwlock_unlock(&board_lock);
+                clock_sleep_ticks(&game_clock, 2);  // o ecrã final fica dois ticks
                 break;
             }
 
             if (result == QUIT_GAME) {
-                pthread_rwlock_rdlock(&board_lock);
-                screen_refresh(&game_board, DRAW_GAME_OVER);
-                pthread_rwlock_unlock(&board_lock);
-                sleep_ms(game_board.tempo);
-
-                if (backup) {
-                    exit(1); //hardquit
+                if (tracing) {
+                    trace_event(&session_trace, TRACE_EVENT_QUIT, 0);
                 }
+                prof_rwlock_rdlock(&board_lock);
+                screen_refresh(&game_board, DRAW_GAME_OVER);
+                prof_rwlock_unlock(&board_lock);
+                clock_sleep_ticks(&game_clock, 2);
 
                 end_game = true;
                 break;
             }
 
-            // Redesenha o tabuleiro após a jogada
-            pthread_rwlock_rdlock(&board_lock);
-            screen_refresh(&game_board, DRAW_MENU);
-            pthread_rwlock_unlock(&board_lock);
+            // Redesenha o tabuleiro após a jogada, os ticks de recuperação não são desenhados
+            if (pending_ticks == 0) {
+                uint64_t started = clock_now_ns();
+                prof_rwlock_rdlock(&board_lock);
+                screen_refresh(&game_board, DRAW_MENU);
+                prof_rwlock_unlock(&board_lock);
+                clock_record(&game_clock, CLOCK_RENDER, clock_now_ns() - started);
+            }
 
             accumulated_points = game_board.pacmans[0].points;
         }
 
-        // termina as threads dos fantasmas do nivel em questão
-        ghosts_should_run = 0;
-        for (int i = 0; i < game_board.n_ghosts; i++) {
-            pthread_join(ghost_threads[i], NULL);
-        }
-        pthread_rwlock_destroy(&board_lock);
+        // termina os workers do scheduler do nivel em questão
+        scheduler_destroy(&scheduler);
+        history_detach(&rewind_history, &game_board);
+        prof_lock_report();                 // só com make LOCK_PROFILE=1
+        prof_rwlock_destroy(&board_lock);
 
         print_board(&game_board);
         unload_level(&game_board);
     }
 
+    board_snapshot_free(&quicksave);
+    if (history_enabled) {
+        history_free(&rewind_history);
+    }
+    if (tracing) {
+        trace_close_write(&session_trace);
+    }
+    // um nível ainda a ser construído em segundo plano (prefetch) acaba e é libertado aqui
+    free_levels();
+    close(tick_fd);
+    metrics_stop();
     terminal_cleanup();
-    close_debug_file();
+    log_close();
+
+    if (show_timing) {
+        clock_report(&game_clock, stderr);
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "engine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MAX_TICKS 1000000UL
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static const char* status_name(engine_status_t status) {
+    switch (status) {
+        case ENGINE_LEVEL_DONE:  return "portal";
+        case ENGINE_PACMAN_DEAD: return "dead";
+        case ENGINE_RUNNING:     return "timeout";
+        default:                 return "none";
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned long max_ticks = DEFAULT_MAX_TICKS;
+    int ghost_workers = 0;
+    sched_mode_t sched_mode = SCHED_DIRECT;
+    unsigned int seed = (unsigned int)time(NULL);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:j:m:s:")) != -1) {
+        switch (opt) {
+            case 't':
+                max_ticks = strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                ghost_workers = atoi(optarg);
+                break;
+            case 's':
+                seed = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                if (scheduler_parse_mode(optarg, &sched_mode) == 0) {
+                    break;
+                }
+                /* fall through */
+            default:
+                printf("Usage: %s [-t max_ticks_per_level] [-j ghost_workers] [-m direct|intent] [-s seed] <level_directory>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        printf("Usage: %s [-t max_ticks_per_level] [-j ghost_workers] [-m direct|intent] [-s seed] <level_directory>\n", argv[0]);
+        return 1;
+    }
+    const char* level_dir = argv[optind];
+
+    engine_t engine;
+    if (engine_init(&engine, level_dir, ghost_workers, sched_mode) != 0) {
+        printf("Error: could not load levels from directory '%s'\n", level_dir);
+        return 1;
+    }
+    engine_seed(&engine, seed);
+    printf("seed=%u\n", seed);
+
+    unsigned long total_ticks = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (engine_next_level(&engine) == 0) {
+        engine_status_t status = ENGINE_RUNNING;
+        while (status == ENGINE_RUNNING && engine.tick < max_ticks) {
+            status = engine_step(&engine, '\0');
+        }
+        total_ticks += engine.tick;
+
+        printf("level=%s result=%s ticks=%lu points=%d\n",
+               engine_board(&engine)->level_name, status_name(status),
+               engine.tick, engine_points(&engine));
+
+        if (status != ENGINE_LEVEL_DONE) {
+            break;
+        }
+    }
+
+    double secs = elapsed_seconds(&start);
+    printf("total_ticks=%lu seconds=%.6f ticks_per_second=%.0f\n",
+           total_ticks, secs, secs > 0 ? total_ticks / secs : 0.0);
+
+    engine_destroy(&engine);
+    return 0;
+}
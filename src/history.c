@@ -0,0 +1,422 @@
+#include "history.h"
+#include "board.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Average deltas per tick the pools are sized for; busier ticks just keep fewer ticks around
+#define CELLS_PER_TICK 8
+#define ENTITIES_PER_TICK 4
+
+int history_init(history_t *history, int capacity, int keyframe_interval) {
+    memset(history, 0, sizeof(*history));
+    if (capacity <= 0 || keyframe_interval <= 0) {
+        return -1;
+    }
+
+    history->capacity = capacity;
+    history->keyframe_interval = keyframe_interval;
+    history->cells_capacity = capacity * CELLS_PER_TICK;
+    history->entities_capacity = capacity * ENTITIES_PER_TICK;
+    history->n_keyframes = capacity / keyframe_interval + 2;
+
+    history->entries = calloc(capacity, sizeof(history_entry_t));
+    history->cells = calloc(history->cells_capacity, sizeof(cell_delta_t));
+    history->entities = calloc(history->entities_capacity, sizeof(entity_delta_t));
+    history->keyframes = calloc(history->n_keyframes, sizeof(board_snapshot_t));
+    history->keyframe_ticks = calloc(history->n_keyframes, sizeof(unsigned long));
+    history->keyframe_valid = calloc(history->n_keyframes, sizeof(int));
+
+    if (!history->entries || !history->cells || !history->entities ||
+        !history->keyframes || !history->keyframe_ticks || !history->keyframe_valid) {
+        perror("calloc history");
+        history_free(history);
+        return -1;
+    }
+    return 0;
+}
+
+void history_free(history_t *history) {
+    if (history->keyframes) {
+        for (int k = 0; k < history->n_keyframes; k++) {
+            board_snapshot_free(&history->keyframes[k]);
+        }
+    }
+    free(history->entries);
+    free(history->cells);
+    free(history->entities);
+    free(history->keyframes);
+    free(history->keyframe_ticks);
+    free(history->keyframe_valid);
+    free(history->pending_cells);
+    free(history->pending_pacmans);
+    free(history->pending_ghosts);
+    free(history->shadow_pacmans);
+    free(history->shadow_ghosts);
+    memset(history, 0, sizeof(*history));
+}
+
+static void take_shadows(history_t *history, const board_t *board) {
+    memcpy(history->shadow_pacmans, board->pacmans, (size_t)board->n_pacmans * sizeof(pacman_t));
+    if (board->n_ghosts > 0) {
+        memcpy(history->shadow_ghosts, board->ghosts, (size_t)board->n_ghosts * sizeof(ghost_t));
+    }
+    memset(history->pending_pacmans, 0, (size_t)board->n_pacmans);
+    if (board->n_ghosts > 0) {
+        memset(history->pending_ghosts, 0, (size_t)board->n_ghosts);
+    }
+    history->n_pending_cells = 0;
+}
+
+// Saves a full copy of the board for the current tick, overwriting the oldest keyframe
+static void take_keyframe(history_t *history, const board_t *board) {
+    int slot = 0;
+    for (int k = 1; k < history->n_keyframes; k++) {
+        if (!history->keyframe_valid[slot]) {
+            break;
+        }
+        if (!history->keyframe_valid[k] || history->keyframe_ticks[k] < history->keyframe_ticks[slot]) {
+            slot = k;
+        }
+    }
+
+    history->keyframe_valid[slot] = 0;
+    if (board_snapshot(board, &history->keyframes[slot]) == 0) {
+        history->keyframe_ticks[slot] = history->tick;
+        history->keyframe_valid[slot] = 1;
+    }
+}
+
+int history_attach(history_t *history, board_t *board) {
+    int n_ghost_slots = board->n_ghosts > 0 ? board->n_ghosts : 1;
+
+    unsigned char *pending_pacmans = realloc(history->pending_pacmans, (size_t)board->n_pacmans);
+    if (pending_pacmans) history->pending_pacmans = pending_pacmans;
+    unsigned char *pending_ghosts = realloc(history->pending_ghosts, (size_t)n_ghost_slots);
+    if (pending_ghosts) history->pending_ghosts = pending_ghosts;
+    pacman_t *shadow_pacmans = realloc(history->shadow_pacmans, (size_t)board->n_pacmans * sizeof(pacman_t));
+    if (shadow_pacmans) history->shadow_pacmans = shadow_pacmans;
+    ghost_t *shadow_ghosts = realloc(history->shadow_ghosts, (size_t)n_ghost_slots * sizeof(ghost_t));
+    if (shadow_ghosts) history->shadow_ghosts = shadow_ghosts;
+
+    if (!pending_pacmans || !pending_ghosts || !shadow_pacmans || !shadow_ghosts) {
+        perror("realloc history");
+        return -1;
+    }
+
+    history->n_pacmans = board->n_pacmans;
+    history->n_ghosts = board->n_ghosts;
+    history->first = 0;
+    history->count = 0;
+    history->tick = 0;
+    memset(history->keyframe_valid, 0, (size_t)history->n_keyframes * sizeof(int));
+
+    take_shadows(history, board);
+    take_keyframe(history, board);
+
+    board->history = history;
+    return 0;
+}
+
+void history_detach(history_t *history, board_t *board) {
+    if (board->history == history) {
+        board->history = NULL;
+    }
+}
+
+void history_note_cell(history_t *history, int index) {
+    if (history->n_pending_cells == history->pending_capacity) {
+        int capacity = history->pending_capacity ? history->pending_capacity * 2 : 16;
+        int *tmp = realloc(history->pending_cells, (size_t)capacity * sizeof(int));
+        if (!tmp) {
+            return;
+        }
+        history->pending_cells = tmp;
+        history->pending_capacity = capacity;
+    }
+    history->pending_cells[history->n_pending_cells++] = index;
+}
+
+void history_note_pacman(history_t *history, int pacman_index) {
+    history->pending_pacmans[pacman_index] = 1;
+}
+
+void history_note_ghost(history_t *history, int ghost_index) {
+    history->pending_ghosts[ghost_index] = 1;
+}
+
+// Number of commands whose turns_left differ between two move lists
+static int changed_moves(const command_t *old_moves, const command_t *new_moves, int n_moves) {
+    int changed = 0;
+    for (int m = 0; m < n_moves; m++) {
+        if (old_moves[m].turns_left != new_moves[m].turns_left) {
+            changed++;
+        }
+    }
+    return changed;
+}
+
+static int pacman_deltas(const pacman_t *old_pac, const pacman_t *pac) {
+    int moves = changed_moves(old_pac->moves, pac->moves, pac->n_moves);
+    if (moves > 0) return moves;
+    if (old_pac->pos_x != pac->pos_x || old_pac->pos_y != pac->pos_y ||
+        old_pac->alive != pac->alive || old_pac->points != pac->points ||
+        old_pac->waiting != pac->waiting || old_pac->current_move != pac->current_move ||
+        old_pac->rng != pac->rng) {
+        return 1;
+    }
+    return 0;
+}
+
+static int ghost_deltas(const ghost_t *old_ghost, const ghost_t *ghost) {
+    int moves = changed_moves(old_ghost->moves, ghost->moves, ghost->n_moves);
+    if (moves > 0) return moves;
+    if (old_ghost->pos_x != ghost->pos_x || old_ghost->pos_y != ghost->pos_y ||
+        old_ghost->charged != ghost->charged || old_ghost->waiting != ghost->waiting ||
+        old_ghost->current_move != ghost->current_move || old_ghost->rng != ghost->rng) {
+        return 1;
+    }
+    return 0;
+}
+
+static entity_delta_t *next_entity_slot(history_t *history) {
+    entity_delta_t *delta = &history->entities[history->entities_head % history->entities_capacity];
+    history->entities_head++;
+    return delta;
+}
+
+static void write_pacman_deltas(history_t *history, int index, const pacman_t *old_pac, const pacman_t *pac) {
+    int written = 0;
+    for (int m = 0; m <= pac->n_moves; m++) {
+        int last = (m == pac->n_moves);
+        if (!last && old_pac->moves[m].turns_left == pac->moves[m].turns_left) continue;
+        if (last && written > 0) break;
+
+        entity_delta_t *delta = next_entity_slot(history);
+        delta->is_ghost = 0;
+        delta->index = (short)index;
+        delta->move_index = last ? -1 : (short)m;
+        delta->turns_left = last ? 0 : pac->moves[m].turns_left;
+        delta->pos_x = pac->pos_x;
+        delta->pos_y = pac->pos_y;
+        delta->alive = pac->alive;
+        delta->points = pac->points;
+        delta->charged = 0;
+        delta->waiting = pac->waiting;
+        delta->current_move = pac->current_move;
+        delta->rng = pac->rng;
+        written++;
+    }
+}
+
+static void write_ghost_deltas(history_t *history, int index, const ghost_t *old_ghost, const ghost_t *ghost) {
+    int written = 0;
+    for (int m = 0; m <= ghost->n_moves; m++) {
+        int last = (m == ghost->n_moves);
+        if (!last && old_ghost->moves[m].turns_left == ghost->moves[m].turns_left) continue;
+        if (last && written > 0) break;
+
+        entity_delta_t *delta = next_entity_slot(history);
+        delta->is_ghost = 1;
+        delta->index = (short)index;
+        delta->move_index = last ? -1 : (short)m;
+        delta->turns_left = last ? 0 : ghost->moves[m].turns_left;
+        delta->pos_x = ghost->pos_x;
+        delta->pos_y = ghost->pos_y;
+        delta->alive = 0;
+        delta->points = 0;
+        delta->charged = ghost->charged;
+        delta->waiting = ghost->waiting;
+        delta->current_move = ghost->current_move;
+        delta->rng = ghost->rng;
+        written++;
+    }
+}
+
+static void evict_oldest(history_t *history) {
+    history->first = (history->first + 1) % history->capacity;
+    history->count--;
+}
+
+// Tick of the oldest entry still in the ring, or one past the last commit if it is empty
+static unsigned long oldest_entry_tick(const history_t *history) {
+    if (history->count == 0) {
+        return history->tick + 1;
+    }
+    return history->entries[history->first].tick;
+}
+
+// Newest keyframe at or before 'tick' from which 'tick' can be rebuilt, -1 if none
+static int find_keyframe(const history_t *history, unsigned long tick) {
+    unsigned long first_entry = oldest_entry_tick(history);
+    int best = -1;
+    for (int k = 0; k < history->n_keyframes; k++) {
+        if (!history->keyframe_valid[k]) continue;
+        unsigned long kt = history->keyframe_ticks[k];
+        if (kt > tick) continue;
+        if (kt != tick && kt + 1 < first_entry) continue;
+        if (best < 0 || kt > history->keyframe_ticks[best]) best = k;
+    }
+    return best;
+}
+
+void history_commit(history_t *history, const board_t *board) {
+    history->tick++;
+
+    int n_cells = history->n_pending_cells;
+    int n_entities = 0;
+    for (int p = 0; p < history->n_pacmans; p++) {
+        if (history->pending_pacmans[p])
+            n_entities += pacman_deltas(&history->shadow_pacmans[p], &board->pacmans[p]);
+    }
+    for (int g = 0; g < history->n_ghosts; g++) {
+        if (history->pending_ghosts[g])
+            n_entities += ghost_deltas(&history->shadow_ghosts[g], &board->ghosts[g]);
+    }
+
+    if (n_cells > history->cells_capacity || n_entities > history->entities_capacity) {
+        // a tick that does not fit the pools at all: restart the ring from a keyframe
+        history->count = 0;
+        memset(history->keyframe_valid, 0, (size_t)history->n_keyframes * sizeof(int));
+        take_keyframe(history, board);
+        take_shadows(history, board);
+        return;
+    }
+
+    // make room, oldest ticks go first
+    while (history->count > 0) {
+        history_entry_t *oldest = &history->entries[history->first];
+        if (history->count < history->capacity &&
+            history->cells_head + n_cells - oldest->cell_start <= (unsigned long)history->cells_capacity &&
+            history->entities_head + n_entities - oldest->entity_start <= (unsigned long)history->entities_capacity) {
+            break;
+        }
+        evict_oldest(history);
+    }
+
+    history_entry_t *entry = &history->entries[(history->first + history->count) % history->capacity];
+    history->count++;
+    entry->tick = history->tick;
+
+    entry->cell_start = history->cells_head;
+    entry->n_cells = n_cells;
+    for (int i = 0; i < n_cells; i++) {
+        int index = history->pending_cells[i];
+        cell_delta_t *delta = &history->cells[history->cells_head % history->cells_capacity];
+        delta->index = index;
+        delta->cell = board->board[index];
+        history->cells_head++;
+    }
+
+    entry->entity_start = history->entities_head;
+    for (int p = 0; p < history->n_pacmans; p++) {
+        if (history->pending_pacmans[p] && pacman_deltas(&history->shadow_pacmans[p], &board->pacmans[p]) > 0) {
+            write_pacman_deltas(history, p, &history->shadow_pacmans[p], &board->pacmans[p]);
+            history->shadow_pacmans[p] = board->pacmans[p];
+        }
+        history->pending_pacmans[p] = 0;
+    }
+    for (int g = 0; g < history->n_ghosts; g++) {
+        if (history->pending_ghosts[g] && ghost_deltas(&history->shadow_ghosts[g], &board->ghosts[g]) > 0) {
+            write_ghost_deltas(history, g, &history->shadow_ghosts[g], &board->ghosts[g]);
+            history->shadow_ghosts[g] = board->ghosts[g];
+        }
+        history->pending_ghosts[g] = 0;
+    }
+    entry->n_entities = (int)(history->entities_head - entry->entity_start);
+    history->n_pending_cells = 0;
+
+    // evictions may have cut the ring off its newest keyframe, start a new one right away
+    if (history->tick % history->keyframe_interval == 0 || find_keyframe(history, history->tick) < 0) {
+        take_keyframe(history, board);
+    }
+}
+
+unsigned long history_oldest_tick(const history_t *history) {
+    unsigned long first_entry = oldest_entry_tick(history);
+    unsigned long oldest = history->tick;
+    for (int k = 0; k < history->n_keyframes; k++) {
+        if (!history->keyframe_valid[k]) continue;
+        unsigned long kt = history->keyframe_ticks[k];
+        if ((kt + 1 >= first_entry || kt == history->tick) && kt < oldest) oldest = kt;
+    }
+    return oldest;
+}
+
+unsigned long history_latest_tick(const history_t *history) {
+    return history->tick;
+}
+
+static void apply_entry(const history_t *history, const history_entry_t *entry, board_t *board) {
+    for (int i = 0; i < entry->n_cells; i++) {
+        const cell_delta_t *delta = &history->cells[(entry->cell_start + i) % history->cells_capacity];
+        board->board[delta->index] = delta->cell;
+    }
+
+    for (int i = 0; i < entry->n_entities; i++) {
+        const entity_delta_t *delta = &history->entities[(entry->entity_start + i) % history->entities_capacity];
+        if (delta->is_ghost) {
+            ghost_t *ghost = &board->ghosts[delta->index];
+            ghost->pos_x = delta->pos_x;
+            ghost->pos_y = delta->pos_y;
+            ghost->charged = delta->charged;
+            ghost->waiting = delta->waiting;
+            ghost->current_move = delta->current_move;
+            ghost->rng = delta->rng;
+            if (delta->move_index >= 0) ghost->moves[delta->move_index].turns_left = delta->turns_left;
+        } else {
+            pacman_t *pac = &board->pacmans[delta->index];
+            pac->pos_x = delta->pos_x;
+            pac->pos_y = delta->pos_y;
+            pac->alive = delta->alive;
+            pac->points = delta->points;
+            pac->waiting = delta->waiting;
+            pac->current_move = delta->current_move;
+            pac->rng = delta->rng;
+            if (delta->move_index >= 0) pac->moves[delta->move_index].turns_left = delta->turns_left;
+        }
+    }
+}
+
+int history_rewind(history_t *history, board_t *board, unsigned long tick) {
+    if (tick > history->tick) {
+        return -1;
+    }
+    int k = find_keyframe(history, tick);
+    if (k < 0) {
+        return -1;
+    }
+
+    if (board_restore(board, &history->keyframes[k]) != 0) {
+        return -1;
+    }
+
+    // replay the deltas between the keyframe and the wanted tick
+    unsigned long first_entry = oldest_entry_tick(history);
+    for (unsigned long t = history->keyframe_ticks[k] + 1; t <= tick; t++) {
+        const history_entry_t *entry = &history->entries[(history->first + (t - first_entry)) % history->capacity];
+        apply_entry(history, entry, board);
+    }
+
+    // everything after 'tick' is gone, recording carries on from there
+    if (tick < first_entry) {
+        history->count = 0;
+    } else {
+        history->count = (int)(tick - first_entry + 1);
+        const history_entry_t *last = &history->entries[(history->first + history->count - 1) % history->capacity];
+        history->cells_head = last->cell_start + last->n_cells;
+        history->entities_head = last->entity_start + last->n_entities;
+    }
+    for (int i = 0; i < history->n_keyframes; i++) {
+        if (history->keyframe_valid[i] && history->keyframe_ticks[i] > tick) {
+            history->keyframe_valid[i] = 0;
+        }
+    }
+
+    history->tick = tick;
+    take_shadows(history, board);
+    if (board_index_entities(board) != 0) {
+        return -1;
+    }
+    return board_index_blockers(board);
+}
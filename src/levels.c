@@ -0,0 +1,298 @@
+#include "levels.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "PACMIDX"
+#define INDEX_VERSION 1
+
+/* cabeçalho da cache, seguido dos nomes dos ficheiros (sem a diretoria) separados por '\0' */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_levels;
+    uint64_t dir_dev;
+    uint64_t dir_ino;
+    int64_t dir_mtime_sec;      // a cache só serve se a diretoria não mudou desde o scan
+    int64_t dir_mtime_nsec;
+    uint64_t names_len;
+} index_header_t;
+
+typedef struct {
+    int number;
+    const char* path;
+} level_entry_t;
+
+/* acrescenta "<dir>/<name>" à arena, que cresce para o dobro quando enche */
+static int append_path(level_index_t* index, const char* dir, size_t dir_len, const char* name, size_t name_len) {
+    size_t need = dir_len + 1 + name_len + 1;
+    if (index->arena_len + need > index->arena_cap) {
+        size_t cap = index->arena_cap ? index->arena_cap : 4096;
+        while (cap < index->arena_len + need) {
+            cap *= 2;
+        }
+        char* arena = realloc(index->arena, cap);
+        if (!arena) {
+            perror("realloc level arena");
+            return -1;
+        }
+        index->arena = arena;
+        index->arena_cap = cap;
+    }
+
+    char* p = index->arena + index->arena_len;
+    memcpy(p, dir, dir_len);
+    p[dir_len] = '/';
+    memcpy(p + dir_len + 1, name, name_len);
+    p[dir_len + 1 + name_len] = '\0';
+    index->arena_len += need;
+    index->n_levels++;
+    return 0;
+}
+
+/* aponta paths para cada caminho da arena, que já não se vai mover */
+static int link_paths(level_index_t* index) {
+    index->paths = malloc((size_t)index->n_levels * sizeof(char*));
+    if (!index->paths) {
+        perror("malloc level paths");
+        return -1;
+    }
+    index->capacity = index->n_levels;
+
+    char* p = index->arena;
+    for (int i = 0; i < index->n_levels; i++) {
+        index->paths[i] = p;
+        p += strlen(p) + 1;
+    }
+    return 0;
+}
+
+/* número do nível no nome do ficheiro, o primeiro número que aparece */
+static int level_number(const char* name) {
+    const char* p = name;
+
+    // avança até ao primeiro dígito
+    while (*p && !(*p >= '0' && *p <= '9')) {
+        p++;
+    }
+
+    return atoi(p); // atoi lê o número até encontrar "."
+}
+
+static int cmp_level_entries(const void* a, const void* b) {
+    const level_entry_t* A = a;
+    const level_entry_t* B = b;
+
+    if (A->number != B->number) {
+        return A->number < B->number ? -1 : 1;
+    }
+    return strcmp(A->path, B->path);
+}
+
+/* ordena por número de nível, calculado uma vez por ficheiro e não em cada comparação */
+static int sort_paths(level_index_t* index, size_t dir_len) {
+    level_entry_t* entries = malloc((size_t)index->n_levels * sizeof(level_entry_t));
+    if (!entries) {
+        perror("malloc level entries");
+        return -1;
+    }
+    for (int i = 0; i < index->n_levels; i++) {
+        entries[i].path = index->paths[i];
+        entries[i].number = level_number(index->paths[i] + dir_len + 1);
+    }
+
+    qsort(entries, index->n_levels, sizeof(level_entry_t), cmp_level_entries);
+
+    for (int i = 0; i < index->n_levels; i++) {
+        index->paths[i] = (char*)entries[i].path;
+    }
+    free(entries);
+    return 0;
+}
+
+static int cache_path(char* dst, size_t size, const char* level_dir) {
+    int len = snprintf(dst, size, "%s/%s", level_dir, LEVEL_INDEX_CACHE);
+    return (len < 0 || (size_t)len >= size) ? -1 : 0;
+}
+
+static int same_dir(const index_header_t* h, const struct stat* st) {
+    return h->dir_dev == (uint64_t)st->st_dev && h->dir_ino == (uint64_t)st->st_ino &&
+           h->dir_mtime_sec == (int64_t)st->st_mtim.tv_sec && h->dir_mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
+}
+
+/* lê a cache num único read, 0 se serviu */
+static int load_cache(level_index_t* index, const char* level_dir, size_t dir_len, const struct stat* dir_st) {
+    char path[512];
+    if (cache_path(path, sizeof(path), level_dir) != 0) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    char* buf = NULL;
+    ssize_t n = -1;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(index_header_t)) {
+        buf = malloc((size_t)st.st_size);
+        if (buf) {
+            n = read(fd, buf, (size_t)st.st_size);
+        }
+    }
+    close(fd);
+
+    index_header_t h;
+    int ok = buf && n == st.st_size;
+    if (ok) {
+        memcpy(&h, buf, sizeof(h));
+        ok = memcmp(h.magic, INDEX_MAGIC, sizeof(h.magic)) == 0 && h.version == INDEX_VERSION &&
+             same_dir(&h, dir_st) && h.n_levels > 0 &&
+             h.names_len == (uint64_t)st.st_size - sizeof(h) && buf[st.st_size - 1] == '\0';
+    }
+
+    if (ok) {
+        const char* name = buf + sizeof(h);
+        const char* end = buf + st.st_size;
+        for (uint32_t i = 0; ok && i < h.n_levels; i++) {
+            size_t len = strnlen(name, (size_t)(end - name));
+            ok = name + len < end && append_path(index, level_dir, dir_len, name, len) == 0;
+            name += len + 1;
+        }
+        ok = ok && name == end;
+    }
+
+    free(buf);
+    if (!ok) {
+        // cache velha ou estragada, recomeça do zero
+        level_index_free(index);
+        return -1;
+    }
+    return link_paths(index);
+}
+
+/* escreve a cache por cima do ficheiro já aberto, sem criar nem renomear nada: isso mudava
+o mtime da diretoria e a cache nunca servia. A chave é o stat da diretoria tirado antes do
+scan, um .lvl que chegue depois dele já não bate certo com a cache */
+static void write_cache(int fd, const level_index_t* index, size_t dir_len, const struct stat* dir_st) {
+    index_header_t h;
+    memset(&h, 0, sizeof(h));
+
+    // cabeçalho a zeros primeiro: quem ler a meio da escrita vê uma cache inválida
+    if (pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+        return;
+    }
+
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.version = INDEX_VERSION;
+    h.n_levels = (uint32_t)index->n_levels;
+    h.dir_dev = (uint64_t)dir_st->st_dev;
+    h.dir_ino = (uint64_t)dir_st->st_ino;
+    h.dir_mtime_sec = (int64_t)dir_st->st_mtim.tv_sec;
+    h.dir_mtime_nsec = (int64_t)dir_st->st_mtim.tv_nsec;
+    for (int i = 0; i < index->n_levels; i++) {
+        h.names_len += strlen(index->paths[i] + dir_len + 1) + 1;
+    }
+
+    // nomes pela ordem já ordenada, para a próxima leitura não ordenar nada
+    char* names = malloc(h.names_len);
+    if (!names) {
+        return;
+    }
+    char* p = names;
+    for (int i = 0; i < index->n_levels; i++) {
+        size_t len = strlen(index->paths[i] + dir_len + 1) + 1;
+        memcpy(p, index->paths[i] + dir_len + 1, len);
+        p += len;
+    }
+    int ok = pwrite(fd, names, h.names_len, sizeof(h)) == (ssize_t)h.names_len &&
+             ftruncate(fd, (off_t)(sizeof(h) + h.names_len)) == 0;
+    free(names);
+
+    if (ok) {
+        pwrite(fd, &h, sizeof(h), 0);
+    }
+}
+
+static int scan_dir(level_index_t* index, const char* level_dir, size_t dir_len) {
+    DIR* dir = opendir(level_dir);
+    if (!dir) {
+        perror("opendir init_levels");
+        return -1;
+    }
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        const char* name = ent->d_name;
+
+        // aceita só ficheiros que terminem em .lvl
+        size_t len = strlen(name);
+        if (len < 4 || strcmp(name + (len - 4), ".lvl") != 0)
+            continue;
+
+        if (append_path(index, level_dir, dir_len, name, len) != 0) {
+            closedir(dir);
+            return -1;
+        }
+    }
+
+    closedir(dir);
+
+    if (index->n_levels == 0) {
+        fprintf(stderr, "No .lvl files found in %s\n", level_dir);
+        return -1;
+    }
+    return link_paths(index) == 0 ? sort_paths(index, dir_len) : -1;
+}
+
+int level_index_build(level_index_t* index, const char* level_dir) {
+    memset(index, 0, sizeof(*index));
+    size_t dir_len = strlen(level_dir);
+
+    // PACMANIST_NO_INDEX_CACHE: nem lê nem escreve nada na diretoria dos níveis
+    if (getenv(LEVEL_INDEX_OPT_OUT)) {
+        if (scan_dir(index, level_dir, dir_len) != 0) {
+            level_index_free(index);
+            return -1;
+        }
+        return 0;
+    }
+
+    struct stat dir_st;
+    if (stat(level_dir, &dir_st) == 0 && load_cache(index, level_dir, dir_len, &dir_st) == 0) {
+        return 0;
+    }
+
+    // a cache é criada antes do stat que serve de chave, criá-la muda o mtime da diretoria;
+    // se a diretoria não deixa, fica sem cache
+    char path[512];
+    int fd = cache_path(path, sizeof(path), level_dir) == 0 ? open(path, O_RDWR | O_CREAT, 0644) : -1;
+    int keyed = fd >= 0 && stat(level_dir, &dir_st) == 0;
+
+    if (scan_dir(index, level_dir, dir_len) != 0) {
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size == 0) {
+            unlink(path);   // não há níveis, não deixa uma cache vazia para trás
+        }
+        if (fd >= 0) close(fd);
+        level_index_free(index);
+        return -1;
+    }
+    if (keyed) {
+        write_cache(fd, index, dir_len, &dir_st);
+    }
+    if (fd >= 0) close(fd);
+    return 0;
+}
+
+void level_index_free(level_index_t* index) {
+    free(index->arena);
+    free(index->paths);
+    memset(index, 0, sizeof(*index));
+}
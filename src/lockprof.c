@@ -0,0 +1,210 @@
+#include "lockprof.h"
+
+#ifdef LOCK_PROFILE
+
+#include "log.h"
+#include <string.h>
+#include <time.h>
+
+#define LOCKPROF_MAX_SITES 64           // sites listed in one report
+
+typedef struct {
+    const void* lock;                   // a prof_rwlock_t or a prof_mutex_t
+    lock_site_t* site;
+    unsigned long since;
+} held_lock_t;
+
+static _Atomic(lock_site_t*) sites;     // every site that ever took a profiled lock
+static _Thread_local held_lock_t held[LOCKPROF_MAX_HELD];
+static _Thread_local int n_held;
+
+static unsigned long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+static void store_max(atomic_ulong* max, unsigned long value) {
+    unsigned long seen = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > seen &&
+           !atomic_compare_exchange_weak_explicit(max, &seen, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static void register_site(lock_site_t* site, const char* lock_name) {
+    int expected = 0;
+    if (!atomic_compare_exchange_strong(&site->registered, &expected, 1)) {
+        return;
+    }
+    site->lock_name = lock_name;
+    lock_site_t* first = atomic_load_explicit(&sites, memory_order_relaxed);
+    do {
+        site->next = first;
+    } while (!atomic_compare_exchange_weak_explicit(&sites, &first, site,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+// Common part of every lock call, 'asked' taken before blocking
+static void acquired(const void* lock, lock_site_t* site, unsigned long asked) {
+    unsigned long got = now_ns();
+
+    atomic_fetch_add_explicit(&site->acquisitions, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->wait_ns, got - asked, memory_order_relaxed);
+    store_max(&site->max_wait_ns, got - asked);
+
+    if (n_held < LOCKPROF_MAX_HELD) {
+        held[n_held++] = (held_lock_t){lock, site, got};
+    }
+}
+
+// Entry of 'lock' taken last on this thread, -1 if it is not there
+static int find_held(const void* lock) {
+    for (int i = n_held - 1; i >= 0; i--) {
+        if (held[i].lock == lock) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void add_hold(int i, unsigned long now) {
+    unsigned long hold = now - held[i].since;
+    atomic_fetch_add_explicit(&held[i].site->hold_ns, hold, memory_order_relaxed);
+    store_max(&held[i].site->max_hold_ns, hold);
+}
+
+// The hold time goes to the site that took this lock last on this thread
+static void released(const void* lock) {
+    int i = find_held(lock);
+    if (i < 0) {
+        return;
+    }
+    add_hold(i, now_ns());
+    memmove(&held[i], &held[i + 1], (size_t)(n_held - i - 1) * sizeof(held_lock_t));
+    n_held--;
+}
+
+int prof_rwlock_init(prof_rwlock_t* lock, const char* name) {
+    lock->name = name;
+    return pthread_rwlock_init(&lock->lock, NULL);
+}
+
+void prof_rwlock_destroy(prof_rwlock_t* lock) {
+    pthread_rwlock_destroy(&lock->lock);
+}
+
+void prof_rwlock_lock(prof_rwlock_t* lock, lock_site_t* site) {
+    register_site(site, lock->name);
+
+    unsigned long asked = now_ns();
+    if (site->write) {
+        pthread_rwlock_wrlock(&lock->lock);
+    } else {
+        pthread_rwlock_rdlock(&lock->lock);
+    }
+    acquired(lock, site, asked);
+}
+
+void prof_rwlock_unlock(prof_rwlock_t* lock) {
+    released(lock);
+    pthread_rwlock_unlock(&lock->lock);
+}
+
+int prof_mutex_init(prof_mutex_t* mutex, const char* name) {
+    mutex->name = name;
+    return pthread_mutex_init(&mutex->lock, NULL);
+}
+
+void prof_mutex_destroy(prof_mutex_t* mutex) {
+    pthread_mutex_destroy(&mutex->lock);
+}
+
+void prof_mutex_lock_at(prof_mutex_t* mutex, lock_site_t* site) {
+    register_site(site, mutex->name);
+
+    unsigned long asked = now_ns();
+    pthread_mutex_lock(&mutex->lock);
+    acquired(mutex, site, asked);
+}
+
+void prof_mutex_unlock(prof_mutex_t* mutex) {
+    released(mutex);
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+int prof_cond_wait(pthread_cond_t* cond, prof_mutex_t* mutex) {
+    // the mutex is free while asleep: close the hold and open a new one on wake up
+    int i = find_held(mutex);
+    if (i >= 0) {
+        add_hold(i, now_ns());
+    }
+    int result = pthread_cond_wait(cond, &mutex->lock);
+    i = find_held(mutex);
+    if (i >= 0) {
+        held[i].since = now_ns();
+    }
+    return result;
+}
+
+void prof_lock_report(void) {
+    lock_site_t* list[LOCKPROF_MAX_SITES];
+    int n = 0;
+
+    for (lock_site_t* site = atomic_load_explicit(&sites, memory_order_acquire); site; site = site->next) {
+        if (atomic_load(&site->acquisitions) == 0 || n == LOCKPROF_MAX_SITES) {
+            continue;
+        }
+        // by wait time, the site that waits most first
+        unsigned long wait = atomic_load(&site->wait_ns);
+        int at = n++;
+        while (at > 0 && atomic_load(&list[at - 1]->wait_ns) < wait) {
+            list[at] = list[at - 1];
+            at--;
+        }
+        list[at] = site;
+    }
+
+    // one block per lock name, the lock with the worst site first
+    int reported[LOCKPROF_MAX_SITES] = {0};
+    for (int first = 0; first < n; first++) {
+        if (reported[first]) {
+            continue;
+        }
+        const char* name = list[first]->lock_name;
+        int n_sites = 0;
+        unsigned long total_wait = 0, total_hold = 0;
+        for (int i = first; i < n; i++) {
+            if (strcmp(list[i]->lock_name, name) == 0) {
+                n_sites++;
+                total_wait += atomic_load(&list[i]->wait_ns);
+                total_hold += atomic_load(&list[i]->hold_ns);
+            }
+        }
+
+        log_info("LOCK %s: %d sites, wait %lu us, held %lu us\n", name, n_sites, total_wait / 1000, total_hold / 1000);
+        for (int i = first; i < n; i++) {
+            if (reported[i] || strcmp(list[i]->lock_name, name) != 0) {
+                continue;
+            }
+            reported[i] = 1;
+
+            // the counters start over at every report, whatever LOG_LEVEL left of the print
+            lock_site_t* site = list[i];
+            unsigned long count = atomic_exchange(&site->acquisitions, 0);
+            unsigned long wait = atomic_exchange(&site->wait_ns, 0);
+            unsigned long max_wait = atomic_exchange(&site->max_wait_ns, 0);
+            unsigned long hold = atomic_exchange(&site->hold_ns, 0);
+            unsigned long max_hold = atomic_exchange(&site->max_hold_ns, 0);
+#if LOG_LEVEL <= LOG_INFO
+            log_info("  %s:%d %s %s n=%lu wait mean=%lu max=%lu ns, hold mean=%lu max=%lu ns\n",
+                     site->file, site->line, site->func, site->write ? "wr" : "rd", count,
+                     count ? wait / count : 0, max_wait, count ? hold / count : 0, max_hold);
+#else
+            (void)count; (void)wait; (void)max_wait; (void)hold; (void)max_hold;
+#endif
+        }
+        (void)n_sites; (void)total_wait; (void)total_hold;
+    }
+}
+
+#endif
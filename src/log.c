@@ -0,0 +1,245 @@
+#include "log.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_MSG_BYTES 512               // messages up to this size are formatted on the stack
+#define LOG_BATCH_BYTES (64 * 1024)     // bytes the flusher gathers before each write()
+
+/*One producer (the thread that owns it) and one consumer (the flusher).
+Bytes in [tail, head) are still to be written; indexes only grow, masked on access*/
+typedef struct log_ring {
+    _Atomic size_t head;                // moved by the owner after copying a whole message
+    _Atomic size_t tail;                // moved by the flusher after taking the bytes
+    atomic_ulong dropped;               // messages that did not fit
+    atomic_int in_use;                  // 0 once the owner thread exited, a new thread can take it
+    struct log_ring* next;
+    char data[LOG_RING_BYTES];
+} log_ring_t;
+
+static _Atomic(log_ring_t*) rings;      // every ring ever created, rings are reused but never freed
+static _Thread_local log_ring_t* my_ring;
+static pthread_key_t ring_key;          // its destructor gives the ring back when a thread exits
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static atomic_int log_active;
+static int log_fd = -1;
+static pthread_t flusher;
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static int flusher_stop = 0;
+static char batch[LOG_BATCH_BYTES];     // only touched by the flusher, or by log_close after joining it
+static size_t batch_len = 0;
+
+static void release_ring(void* ring) {
+    atomic_store_explicit(&((log_ring_t*)ring)->in_use, 0, memory_order_release);
+}
+
+static void create_ring_key(void) {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+// Ring of the calling thread: one left by a thread that exited, or a new one
+static log_ring_t* thread_ring(void) {
+    if (my_ring) {
+        return my_ring;
+    }
+    pthread_once(&ring_key_once, create_ring_key);
+
+    log_ring_t* ring = atomic_load_explicit(&rings, memory_order_acquire);
+    for (; ring; ring = ring->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong_explicit(&ring->in_use, &expected, 1,
+                                                    memory_order_acq_rel, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    if (!ring) {
+        ring = calloc(1, sizeof(log_ring_t));
+        if (!ring) {
+            return NULL;
+        }
+        atomic_store_explicit(&ring->in_use, 1, memory_order_relaxed);
+        log_ring_t* first = atomic_load_explicit(&rings, memory_order_relaxed);
+        do {
+            ring->next = first;
+        } while (!atomic_compare_exchange_weak_explicit(&rings, &first, ring,
+                                                        memory_order_release, memory_order_relaxed));
+    }
+
+    pthread_setspecific(ring_key, ring);
+    my_ring = ring;
+    return ring;
+}
+
+// Copies a whole message or nothing
+static void ring_push(log_ring_t* ring, const char* msg, size_t len) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (len > LOG_RING_BYTES - (head - tail)) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    size_t at = head & (LOG_RING_BYTES - 1);
+    size_t first = len < LOG_RING_BYTES - at ? len : LOG_RING_BYTES - at;
+    memcpy(ring->data + at, msg, first);
+    memcpy(ring->data, msg + first, len - first);
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+void log_write(int level, const char* format, ...) {
+    (void)level;
+    // without a log file open (headless runs) nothing is even formatted
+    if (!atomic_load_explicit(&log_active, memory_order_relaxed)) {
+        return;
+    }
+    log_ring_t* ring = thread_ring();
+    if (!ring) {
+        return;
+    }
+
+    char local[LOG_MSG_BYTES];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(local, sizeof(local), format, args);
+    va_end(args);
+    if (len <= 0) {
+        return;
+    }
+
+    if ((size_t)len < sizeof(local)) {
+        ring_push(ring, local, (size_t)len);
+        return;
+    }
+
+    // big messages (print_board) are rare, they pay for a malloc
+    char* big = malloc((size_t)len + 1);
+    if (!big) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(big, (size_t)len + 1, format, args);
+    va_end(args);
+    ring_push(ring, big, (size_t)len);
+    free(big);
+}
+
+static void flush_batch(void) {
+    size_t done = 0;
+    while (done < batch_len) {
+        ssize_t n = write(log_fd, batch + done, batch_len - done);
+        if (n <= 0) {
+            break;      // nowhere to log the failure of the log
+        }
+        done += (size_t)n;
+    }
+    batch_len = 0;
+}
+
+static void batch_append(const char* bytes, size_t len) {
+    while (len > 0) {
+        if (batch_len == sizeof(batch)) {
+            flush_batch();
+        }
+        size_t n = len < sizeof(batch) - batch_len ? len : sizeof(batch) - batch_len;
+        memcpy(batch + batch_len, bytes, n);
+        batch_len += n;
+        bytes += n;
+        len -= n;
+    }
+}
+
+// Moves everything the rings hold into batched writes
+static void drain_rings(void) {
+    unsigned long dropped = 0;
+
+    for (log_ring_t* ring = atomic_load_explicit(&rings, memory_order_acquire); ring; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head != tail) {
+            size_t at = tail & (LOG_RING_BYTES - 1);
+            size_t len = head - tail;
+            size_t first = len < LOG_RING_BYTES - at ? len : LOG_RING_BYTES - at;
+            batch_append(ring->data + at, first);
+            batch_append(ring->data, len - first);
+            atomic_store_explicit(&ring->tail, head, memory_order_release);
+        }
+        dropped += atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+    }
+
+    if (dropped) {
+        char msg[64];
+        int len = snprintf(msg, sizeof(msg), "LOG: %lu messages dropped\n", dropped);
+        batch_append(msg, (size_t)len);
+    }
+    flush_batch();
+}
+
+static void* flusher_thread(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&flusher_lock);
+    while (!flusher_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_FLUSH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&flusher_cond, &flusher_lock, &deadline);
+
+        pthread_mutex_unlock(&flusher_lock);
+        drain_rings();
+        pthread_mutex_lock(&flusher_lock);
+    }
+    pthread_mutex_unlock(&flusher_lock);
+    return NULL;
+}
+
+int log_open(const char* path) {
+    if (atomic_load(&log_active)) {
+        return 0;
+    }
+    log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (log_fd < 0) {
+        perror("open log");
+        return -1;
+    }
+
+    flusher_stop = 0;
+    if (pthread_create(&flusher, NULL, flusher_thread, NULL) != 0) {
+        perror("pthread_create log flusher");
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+    atomic_store(&log_active, 1);
+    return 0;
+}
+
+void log_close(void) {
+    if (!atomic_load(&log_active)) {
+        return;
+    }
+    atomic_store(&log_active, 0);
+
+    pthread_mutex_lock(&flusher_lock);
+    flusher_stop = 1;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&flusher_lock);
+    pthread_join(flusher, NULL);
+
+    // what was logged after the last drain
+    drain_rings();
+    close(log_fd);
+    log_fd = -1;
+}
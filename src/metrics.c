@@ -0,0 +1,263 @@
+#include "metrics.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    atomic_ulong buckets[METRICS_HIST_BUCKETS];
+    atomic_ulong count;
+    atomic_ulong total_ns;
+    atomic_ulong max_ns;
+} metrics_hist_t;
+
+/*Written only by the thread that owns it, read by the writer thread*/
+typedef struct metrics_slot {
+    atomic_ulong counters[METRIC_N_COUNTERS];
+    metrics_hist_t hists[METRIC_N_HISTS];
+    atomic_int in_use;                  // 0 once the owner thread exited, a new thread can take it
+    struct metrics_slot* next;
+} metrics_slot_t;
+
+static const char* counter_names[METRIC_N_COUNTERS] = {
+    "pacman_moves", "pacman_invalid", "pacman_deaths", "dots_eaten", "portals",
+    "ghost_moves", "ghost_wall_hits", "ghost_collisions", "ghost_kills",
+    "worker_shares", "ticks", "frames",
+};
+
+static const char* hist_names[METRIC_N_HISTS] = {
+    "move_pacman", "move_ghost", "worker_share", "lock_wait", "lock_hold",
+    "play_board", "screen_refresh",
+};
+
+static _Atomic(metrics_slot_t*) slots;  // every slot ever created, reused but never freed
+static _Thread_local metrics_slot_t* my_slot;
+static pthread_key_t slot_key;          // its destructor gives the slot back when a thread exits
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+static atomic_int metrics_active;
+static char* stats_path = NULL;
+static uint64_t started_ns;
+static pthread_t writer;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static int writer_stop = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void release_slot(void* slot) {
+    atomic_store_explicit(&((metrics_slot_t*)slot)->in_use, 0, memory_order_release);
+}
+
+static void create_slot_key(void) {
+    pthread_key_create(&slot_key, release_slot);
+}
+
+// Slot of the calling thread: one left by a thread that exited, or a new one
+static metrics_slot_t* thread_slot(void) {
+    if (my_slot) {
+        return my_slot;
+    }
+    pthread_once(&slot_key_once, create_slot_key);
+
+    metrics_slot_t* slot = atomic_load_explicit(&slots, memory_order_acquire);
+    for (; slot; slot = slot->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong_explicit(&slot->in_use, &expected, 1,
+                                                    memory_order_acq_rel, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    if (!slot) {
+        slot = calloc(1, sizeof(metrics_slot_t));
+        if (!slot) {
+            return NULL;
+        }
+        atomic_store_explicit(&slot->in_use, 1, memory_order_relaxed);
+        metrics_slot_t* first = atomic_load_explicit(&slots, memory_order_relaxed);
+        do {
+            slot->next = first;
+        } while (!atomic_compare_exchange_weak_explicit(&slots, &first, slot,
+                                                        memory_order_release, memory_order_relaxed));
+    }
+
+    pthread_setspecific(slot_key, slot);
+    my_slot = slot;
+    return slot;
+}
+
+// Only the owner writes its slot, a load + store is enough (and cheaper than fetch_add)
+static inline void bump(atomic_ulong* value, unsigned long n) {
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+void metrics_count(metric_counter_t counter, unsigned long n) {
+    if (!atomic_load_explicit(&metrics_active, memory_order_relaxed)) {
+        return;
+    }
+    metrics_slot_t* slot = thread_slot();
+    if (slot) {
+        bump(&slot->counters[counter], n);
+    }
+}
+
+uint64_t metrics_clock(void) {
+    if (!atomic_load_explicit(&metrics_active, memory_order_relaxed)) {
+        return 0;
+    }
+    return now_ns();
+}
+
+void metrics_elapsed(metric_hist_t hist, uint64_t started) {
+    if (started == 0) {
+        return;
+    }
+    uint64_t ns = now_ns() - started;
+    metrics_slot_t* slot = thread_slot();
+    if (!slot) {
+        return;
+    }
+
+    int bucket = 0;
+    for (uint64_t v = ns; v > 1 && bucket < METRICS_HIST_BUCKETS - 1; v >>= 1) {
+        bucket++;
+    }
+    metrics_hist_t* h = &slot->hists[hist];
+    bump(&h->buckets[bucket], 1);
+    bump(&h->count, 1);
+    bump(&h->total_ns, ns);
+    if (ns > atomic_load_explicit(&h->max_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max_ns, ns, memory_order_relaxed);
+    }
+}
+
+// Upper bound (ns) of the bucket holding the given fraction of the samples
+static unsigned long percentile_ns(const unsigned long* buckets, unsigned long count, double fraction) {
+    unsigned long wanted = (unsigned long)(fraction * (double)count);
+    unsigned long seen = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > wanted) {
+            return 2UL << i;
+        }
+    }
+    return 2UL << (METRICS_HIST_BUCKETS - 1);
+}
+
+// Sums every slot and rewrites the stats file
+static void write_stats(void) {
+    unsigned long counters[METRIC_N_COUNTERS] = {0};
+    unsigned long buckets[METRIC_N_HISTS][METRICS_HIST_BUCKETS];
+    unsigned long count[METRIC_N_HISTS] = {0}, total[METRIC_N_HISTS] = {0}, max[METRIC_N_HISTS] = {0};
+    memset(buckets, 0, sizeof(buckets));
+
+    for (metrics_slot_t* slot = atomic_load_explicit(&slots, memory_order_acquire); slot; slot = slot->next) {
+        for (int c = 0; c < METRIC_N_COUNTERS; c++) {
+            counters[c] += atomic_load_explicit(&slot->counters[c], memory_order_relaxed);
+        }
+        for (int h = 0; h < METRIC_N_HISTS; h++) {
+            metrics_hist_t* hist = &slot->hists[h];
+            for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+                buckets[h][b] += atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+            }
+            count[h] += atomic_load_explicit(&hist->count, memory_order_relaxed);
+            total[h] += atomic_load_explicit(&hist->total_ns, memory_order_relaxed);
+            unsigned long m = atomic_load_explicit(&hist->max_ns, memory_order_relaxed);
+            if (m > max[h]) max[h] = m;
+        }
+    }
+
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path) >= (int)sizeof(tmp)) {
+        return;
+    }
+    FILE* f = fopen(tmp, "w");
+    if (!f) {
+        return;
+    }
+
+    fprintf(f, "uptime_ms %lu\n", (unsigned long)((now_ns() - started_ns) / 1000000));
+    for (int c = 0; c < METRIC_N_COUNTERS; c++) {
+        fprintf(f, "%s %lu\n", counter_names[c], counters[c]);
+    }
+    for (int h = 0; h < METRIC_N_HISTS; h++) {
+        // buckets are read one by one while the owners keep adding, the summary is approximate
+        fprintf(f, "%s_ns count=%lu mean=%lu p50<%lu p99<%lu max=%lu\n", hist_names[h], count[h],
+                count[h] ? total[h] / count[h] : 0,
+                count[h] ? percentile_ns(buckets[h], count[h], 0.50) : 0,
+                count[h] ? percentile_ns(buckets[h], count[h], 0.99) : 0, max[h]);
+    }
+
+    if (fclose(f) != 0) {
+        remove(tmp);
+        return;
+    }
+    rename(tmp, stats_path);
+}
+
+static void* writer_thread(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&writer_lock);
+    while (!writer_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += METRICS_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (METRICS_INTERVAL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&writer_cond, &writer_lock, &deadline);
+
+        pthread_mutex_unlock(&writer_lock);
+        write_stats();
+        pthread_mutex_lock(&writer_lock);
+    }
+    pthread_mutex_unlock(&writer_lock);
+    return NULL;
+}
+
+int metrics_start(const char* path) {
+    if (atomic_load(&metrics_active)) {
+        return 0;
+    }
+    stats_path = strdup(path);
+    if (!stats_path) {
+        return -1;
+    }
+    started_ns = now_ns();
+
+    writer_stop = 0;
+    if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+        perror("pthread_create metrics writer");
+        free(stats_path);
+        stats_path = NULL;
+        return -1;
+    }
+    atomic_store(&metrics_active, 1);
+    return 0;
+}
+
+void metrics_stop(void) {
+    if (!atomic_load(&metrics_active)) {
+        return;
+    }
+    atomic_store(&metrics_active, 0);
+
+    pthread_mutex_lock(&writer_lock);
+    writer_stop = 1;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer, NULL);
+
+    free(stats_path);
+    stats_path = NULL;
+}
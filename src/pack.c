@@ -0,0 +1,268 @@
+#include "pack.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct {
+    pack_level_t* levels;
+    int n_levels;
+    pack_behavior_t* behaviors;
+    int n_behaviors;
+    int behaviors_capacity;
+    board_pos_t** cells;            // grid of each level until it is written
+} pack_builder_t;
+
+static inline uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Index of the behavior called 'name', parsing the file the first time it shows up
+static int find_or_add_behavior(pack_builder_t* pb, const char* base_dir, const char* name) {
+    for (int i = 0; i < pb->n_behaviors; i++) {
+        if (strcmp(pb->behaviors[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    if (pb->n_behaviors == pb->behaviors_capacity) {
+        int capacity = pb->behaviors_capacity ? pb->behaviors_capacity * 2 : 16;
+        pack_behavior_t* behaviors = realloc(pb->behaviors, (size_t)capacity * sizeof(pack_behavior_t));
+        if (!behaviors) {
+            perror("realloc pack behaviors");
+            return -1;
+        }
+        pb->behaviors = behaviors;
+        pb->behaviors_capacity = capacity;
+    }
+
+    pack_behavior_t* b = &pb->behaviors[pb->n_behaviors];
+    memset(b, 0, sizeof(*b));
+    strncpy(b->name, name, sizeof(b->name) - 1);
+
+    char fullpath[512];
+    snprintf(fullpath, sizeof(fullpath), "%s/%s", base_dir, name);
+
+    int passo = 0, row = 0, col = 0, n_moves = 0;
+    command_t moves[MAX_MOVES];
+    if (parse_behavior_file(fullpath, &passo, &row, &col, moves, &n_moves) == 0) {
+        b->valid = 1;
+        b->passo = passo;
+        b->row = row;
+        b->col = col;
+        b->n_moves = n_moves;
+        for (int i = 0; i < n_moves; i++) {
+            b->moves[i].command = moves[i].command;
+            b->moves[i].turns = moves[i].turns;
+        }
+    }
+    return pb->n_behaviors++;
+}
+
+static int build_level(pack_builder_t* pb, const level_set_t* levels, int index) {
+    pack_level_t* lvl = &pb->levels[index];
+    board_t board;
+    memset(&board, 0, sizeof(board));
+    memset(lvl, 0, sizeof(*lvl));
+
+    int default_pac_x = 1, default_pac_y = 1;
+    if (parse_level_file(levels->index.paths[index], &board, &default_pac_x, &default_pac_y) != 0 || !board.board) {
+        fprintf(stderr, "Could not parse %s\n", levels->index.paths[index]);
+        free(board.board);
+        return -1;
+    }
+
+    memcpy(lvl->name, board.level_name, sizeof(lvl->name));
+    lvl->width = board.width;
+    lvl->height = board.height;
+    lvl->tempo = board.tempo;
+    lvl->default_pac_x = default_pac_x;
+    lvl->default_pac_y = default_pac_y;
+    lvl->pacman = -1;
+    if (board.pacman_file[0] != '\0') {
+        lvl->pacman = find_or_add_behavior(pb, levels->base_dir, board.pacman_file);
+    }
+    lvl->n_ghosts = board.n_ghosts;
+    for (int i = 0; i < board.n_ghosts; i++) {
+        lvl->ghosts[i] = find_or_add_behavior(pb, levels->base_dir, board.ghosts_files[i]);
+    }
+
+    pb->cells[index] = board.board;
+    return 0;
+}
+
+static int write_pack(const pack_builder_t* pb, const char* out_path) {
+    pack_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.n_levels = (uint32_t)pb->n_levels;
+    header.n_behaviors = (uint32_t)pb->n_behaviors;
+    header.levels_offset = align8(sizeof(header));
+    header.behaviors_offset = align8(header.levels_offset + (uint64_t)pb->n_levels * sizeof(pack_level_t));
+
+    uint64_t offset = align8(header.behaviors_offset + (uint64_t)pb->n_behaviors * sizeof(pack_behavior_t));
+    for (int i = 0; i < pb->n_levels; i++) {
+        pb->levels[i].cells_offset = offset;
+        offset = align8(offset + (uint64_t)pb->levels[i].width * pb->levels[i].height);
+    }
+    header.file_size = offset;
+
+    FILE* f = fopen(out_path, "wb");
+    if (!f) {
+        perror("fopen pack");
+        return -1;
+    }
+
+    static const unsigned char zeros[8] = {0};
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(zeros, 1, header.levels_offset - sizeof(header), f) == header.levels_offset - sizeof(header);
+    ok = ok && fwrite(pb->levels, sizeof(pack_level_t), pb->n_levels, f) == (size_t)pb->n_levels;
+    long pos = ftell(f);
+    ok = ok && fwrite(zeros, 1, header.behaviors_offset - pos, f) == header.behaviors_offset - pos;
+    ok = ok && fwrite(pb->behaviors, sizeof(pack_behavior_t), pb->n_behaviors, f) == (size_t)pb->n_behaviors;
+    for (int i = 0; ok && i < pb->n_levels; i++) {
+        pos = ftell(f);
+        size_t n_cells = (size_t)pb->levels[i].width * pb->levels[i].height;
+        ok = fwrite(zeros, 1, pb->levels[i].cells_offset - pos, f) == pb->levels[i].cells_offset - pos &&
+             fwrite(pb->cells[i], sizeof(board_pos_t), n_cells, f) == n_cells;
+    }
+    pos = ftell(f);
+    ok = ok && fwrite(zeros, 1, header.file_size - pos, f) == header.file_size - pos;
+
+    if (fclose(f) != 0 || !ok) {
+        perror("write pack");
+        return -1;
+    }
+    return 0;
+}
+
+int pack_compile(const char* level_dir, const char* out_path) {
+    level_set_t levels;
+    if (level_set_init(&levels, level_dir) != 0) {
+        return -1;
+    }
+    if (levels.pack != NULL) {
+        // level_set_init also opens packs, but a pack is only built from the .lvl files
+        fprintf(stderr, "%s is a level pack, pack_compile needs a level directory\n", level_dir);
+        level_set_free(&levels);
+        return -1;
+    }
+
+    pack_builder_t pb;
+    memset(&pb, 0, sizeof(pb));
+    pb.n_levels = levels.n_levels;
+    pb.levels = calloc(levels.n_levels, sizeof(pack_level_t));
+    pb.cells = calloc(levels.n_levels, sizeof(board_pos_t*));
+
+    int ret = 0;
+    if (!pb.levels || !pb.cells) {
+        perror("calloc pack");
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < levels.n_levels; i++) {
+        ret = build_level(&pb, &levels, i);
+    }
+    if (ret == 0) {
+        ret = write_pack(&pb, out_path);
+    }
+
+    if (pb.cells) {
+        for (int i = 0; i < pb.n_levels; i++) {
+            free(pb.cells[i]);
+        }
+    }
+    free(pb.cells);
+    free(pb.levels);
+    free(pb.behaviors);
+    level_set_free(&levels);
+    return ret;
+}
+
+int pack_open(pack_t* pack, const char* path) {
+    memset(pack, 0, sizeof(*pack));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open pack");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(pack_header_t)) {
+        fprintf(stderr, "%s is not a level pack\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap pack");
+        return -1;
+    }
+    pack->data = data;
+    pack->size = (size_t)st.st_size;
+    pack->header = data;
+
+    const pack_header_t* h = pack->header;
+    if (memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) != 0 || h->version != PACK_VERSION ||
+        h->file_size != pack->size ||
+        h->levels_offset + (uint64_t)h->n_levels * sizeof(pack_level_t) > pack->size ||
+        h->behaviors_offset + (uint64_t)h->n_behaviors * sizeof(pack_behavior_t) > pack->size) {
+        fprintf(stderr, "%s is not a level pack (version %d)\n", path, PACK_VERSION);
+        pack_close(pack);
+        return -1;
+    }
+
+    pack->levels = (const pack_level_t*)(pack->data + h->levels_offset);
+    pack->behaviors = (const pack_behavior_t*)(pack->data + h->behaviors_offset);
+    return 0;
+}
+
+void pack_close(pack_t* pack) {
+    if (pack->data) {
+        munmap((void*)pack->data, pack->size);
+    }
+    memset(pack, 0, sizeof(*pack));
+}
+
+const pack_level_t* pack_level(const pack_t* pack, int index) {
+    if (index < 0 || (uint32_t)index >= pack->header->n_levels) {
+        return NULL;
+    }
+    return &pack->levels[index];
+}
+
+const pack_behavior_t* pack_behavior(const pack_t* pack, int index) {
+    if (index < 0 || (uint32_t)index >= pack->header->n_behaviors) {
+        return NULL;
+    }
+    return &pack->behaviors[index];
+}
+
+const board_pos_t* pack_cells(const pack_t* pack, const pack_level_t* level) {
+    if (level->width <= 0 || level->height <= 0 || level->n_ghosts < 0 || level->n_ghosts > MAX_GHOSTS) {
+        return NULL;
+    }
+    uint64_t n_cells = (uint64_t)level->width * level->height;
+    if (level->cells_offset > pack->size || n_cells > pack->size - level->cells_offset) {
+        return NULL;
+    }
+    return (const board_pos_t*)(pack->data + level->cells_offset);
+}
+
+int pack_behavior_moves(const pack_behavior_t* behavior, command_t* moves) {
+    int n_moves = behavior->n_moves;
+    if (n_moves < 0) n_moves = 0;
+    if (n_moves > MAX_MOVES) n_moves = MAX_MOVES;
+    for (int i = 0; i < n_moves; i++) {
+        moves[i].command = (char)behavior->moves[i].command;
+        moves[i].turns = behavior->moves[i].turns;
+        moves[i].turns_left = behavior->moves[i].turns;
+    }
+    return n_moves;
+}
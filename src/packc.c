@@ -0,0 +1,23 @@
+#include "pack.h"
+#include <stdio.h>
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("Usage: %s <level_directory> <output_pack>\n", argv[0]);
+        return 1;
+    }
+
+    if (pack_compile(argv[1], argv[2]) != 0) {
+        printf("Error: could not build a pack from '%s'\n", argv[1]);
+        return 1;
+    }
+
+    pack_t pack;
+    if (pack_open(&pack, argv[2]) != 0) {
+        return 1;
+    }
+    printf("pack=%s levels=%u behaviors=%u bytes=%zu\n", argv[2],
+           pack.header->n_levels, pack.header->n_behaviors, pack.size);
+    pack_close(&pack);
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "board.h"
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
@@ -7,19 +8,17 @@
 #include <stdio.h>
 #include <errno.h>
 
-/* remove espaços e caracteres "inuteis" */
-static void trim(char *s) {
-    char *p = s;
-    while (*p == ' ' || *p == '\t') p++;
-    if (p != s) memmove(s, p, strlen(p) + 1);
+/* abaixo disto mmap/munmap custam mais do que ler o ficheiro */
+#define MMAP_MIN_BYTES (64 * 1024)
 
-    size_t l = strlen(s);
-    while (l > 0 && (s[l-1] == '\n' || s[l-1] == '\r' || s[l-1] == ' ' || s[l-1] == '\t')) {
-        s[--l] = '\0';
-    }
-}
+/* ficheiro só para leitura, percorrido uma vez sem cópias: mapeado se for grande, lido se for pequeno */
+typedef struct {
+    const char *data;
+    size_t len;
+    int mapped;
+} mapped_file_t;
 
-static int read_entire_file(const char *path, char **out_buf, ssize_t *out_len) {
+static int map_file(const char *path, mapped_file_t *f) {
     int fd = open(path, O_RDONLY);
     if (fd < 0) {
         perror("open");
@@ -33,40 +32,147 @@ static int read_entire_file(const char *path, char **out_buf, ssize_t *out_len)
         return -1;
     }
 
-    ssize_t size = st.st_size;
-    char *buf = malloc(size + 1);
-    if (!buf) {
-        perror("malloc");
-        close(fd);
-        return -1;
-    }
+    f->len = (size_t)st.st_size;
+    f->data = NULL;
+    f->mapped = f->len >= MMAP_MIN_BYTES;
 
-    ssize_t total = 0;
-    while (total < size) {
-        ssize_t n = read(fd, buf + total, size - total);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            perror("read");
-            free(buf);
+    if (f->mapped) {
+        void *data = mmap(NULL, f->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror("mmap");
             close(fd);
             return -1;
         }
-        if (n == 0) break;
-        total += n;
+        posix_madvise(data, f->len, POSIX_MADV_SEQUENTIAL);
+        f->data = data;
+    } else if (f->len > 0) {
+        char *buf = malloc(f->len);
+        if (!buf) {
+            perror("malloc");
+            close(fd);
+            return -1;
+        }
+        size_t total = 0;
+        while (total < f->len) {
+            ssize_t n = read(fd, buf + total, f->len - total);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("read");
+                free(buf);
+                close(fd);
+                return -1;
+            }
+            if (n == 0) break;
+            total += (size_t)n;
+        }
+        f->data = buf;
+        f->len = total;
     }
 
-    buf[total] = '\0';
     close(fd);
-
-    *out_buf = buf;
-    if (out_len) *out_len = total;
     return 0;
 }
 
+static void unmap_file(mapped_file_t *f) {
+    if (f->mapped) {
+        munmap((void *)f->data, f->len);
+    } else {
+        free((void *)f->data);
+    }
+}
+
+static inline int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static inline int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' || c == '\n';
+}
+
+/* próxima linha de [*pos, end) sem espaços no início e no fim, 0 quando o ficheiro acaba */
+static int next_line(const char **pos, const char *end, const char **line, const char **line_end) {
+    if (*pos >= end) {
+        return 0;
+    }
+
+    const char *s = *pos;
+    const char *nl = memchr(s, '\n', (size_t)(end - s));
+    const char *e = nl ? nl : end;
+    *pos = nl ? nl + 1 : end;
+
+    while (s < e && is_blank(*s)) s++;
+    while (e > s && (is_blank(e[-1]) || e[-1] == '\r')) e--;
+
+    *line = s;
+    *line_end = e;
+    return 1;
+}
+
+/* a linha começa pela palavra 'kw'? avança 's' para depois dela */
+static inline int match_keyword(const char **s, const char *e, const char *kw) {
+    size_t n = strlen(kw);
+    if ((size_t)(e - *s) < n || memcmp(*s, kw, n) != 0) {
+        return 0;
+    }
+    *s += n;
+    return 1;
+}
+
+/* inteiro com sinal opcional depois de espaços, como o %d do scanf */
+static int parse_int(const char **s, const char *e, int *out) {
+    const char *p = *s;
+    while (p < e && is_space(*p)) p++;
+
+    int negative = 0;
+    if (p < e && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p >= e || *p < '0' || *p > '9') {
+        return 0;
+    }
+
+    long value = 0;
+    while (p < e && *p >= '0' && *p <= '9') {
+        if (value < 1000000000L) value = value * 10 + (*p - '0');
+        p++;
+    }
+
+    *out = (int)(negative ? -value : value);
+    *s = p;
+    return 1;
+}
+
+/* próxima palavra separada por 'blank' para dst, cortada a dst_size - 1 caracteres */
+static int next_word(const char **s, const char *e, int (*blank)(char), char *dst, size_t dst_size) {
+    const char *p = *s;
+    while (p < e && blank(*p)) p++;
+    if (p >= e) {
+        *s = p;
+        return 0;
+    }
+
+    const char *w = p;
+    while (p < e && !blank(*p)) p++;
+
+    size_t n = (size_t)(p - w);
+    if (n > dst_size - 1) n = dst_size - 1;
+    memcpy(dst, w, n);
+    dst[n] = '\0';
+    *s = p;
+    return 1;
+}
+
+/* valor de cada caracter da grelha já na forma de board_pos_t */
+static const board_pos_t grid_cell[256] = {
+    ['X'] = CELL_WALL,      // parede
+    ['o'] = CELL_DOT,       // ponto
+    ['@'] = CELL_PORTAL,    // portal
+};
+
 int parse_level_file(const char *path, board_t *board, int *default_pac_x, int *default_pac_y) {
-    char *buf = NULL;
-    ssize_t len = 0;
-    if (read_entire_file(path, &buf, &len) != 0) {
+    mapped_file_t file;
+    if (map_file(path, &file) != 0) {
         return -1;
     }
 
@@ -78,6 +184,8 @@ int parse_level_file(const char *path, board_t *board, int *default_pac_x, int *
     board->board = NULL;
     board->pacmans = NULL;
     board->ghosts = NULL;
+    board->row_blockers = NULL;     // os bitmasks só são criados depois da grelha
+    board->col_blockers = NULL;
 
     // limpa nomes de ficheiros
     board->pacman_file[0] = '\0';
@@ -89,55 +197,41 @@ int parse_level_file(const char *path, board_t *board, int *default_pac_x, int *
     *default_pac_y = 1;
     int found_pac_default = 0;
 
-    char *saveptr = NULL;
-    char *line = strtok_r(buf, "\n", &saveptr);
+    const char *pos = file.data;
+    const char *end = file.data + file.len;
+    const char *line, *line_end;
     int reading_grid = 0;
     int grid_row = 0;
 
-    while (line) {
-        trim(line);
-        
-        // avança para o primeiro char não espaço
-        char *p = line;
-        while (*p == ' ' || *p == '\t') p++;
-
-        if (*p == '#' || *p == '\0') {
-            line = strtok_r(NULL, "\n", &saveptr);
+    while (next_line(&pos, end, &line, &line_end)) {
+        // ignora comentários e linhas vazias
+        if (line == line_end || *line == '#') {
             continue;
         }
 
         if (!reading_grid) {
-            if (strncmp(line, "DIM", 3) == 0) {
+            const char *s = line;
+            if (match_keyword(&s, line_end, "DIM")) {
                 int h, w;
-                if (sscanf(line, "DIM %d %d", &h, &w) == 2) {
+                if (parse_int(&s, line_end, &h) && parse_int(&s, line_end, &w)) {
                     board->height = h;
                     board->width = w;
                 }
-            } else if (strncmp(line, "TEMPO", 5) == 0) {
+            } else if (match_keyword(&s, line_end, "TEMPO")) {
                 int t;
-                if (sscanf(line, "TEMPO %d", &t) == 1) {
+                if (parse_int(&s, line_end, &t)) {
                     board->tempo = t;
                 }
-            } else if (strncmp(line, "PAC", 3) == 0) {
+            } else if (match_keyword(&s, line_end, "PAC")) {
                 // linha com ficheiro de comportamento do pacman
-                char fname[256];
-                if (sscanf(line, "PAC %255s", fname) == 1) {
-                    strncpy(board->pacman_file, fname, sizeof(board->pacman_file) - 1);
-                    board->pacman_file[sizeof(board->pacman_file) - 1] = '\0';
-                }
-            } else if (strncmp(line, "MON", 3) == 0) {
+                next_word(&s, line_end, is_space, board->pacman_file, sizeof(board->pacman_file));
+            } else if (match_keyword(&s, line_end, "MON")) {
                 // linha com ficheiros de comportamento dos monstros
-                char *tok = strtok(line + 3, " \t");
                 board->n_ghosts = 0;
-                while (tok && board->n_ghosts < MAX_GHOSTS) {
-                    while (*tok == ' ' || *tok == '\t') tok++;
-                    if (*tok != '\0') {
-                        strncpy(board->ghosts_files[board->n_ghosts], tok, sizeof(board->ghosts_files[0]) - 1);
-                        board->ghosts_files[board->n_ghosts]
-                            [sizeof(board->ghosts_files[0]) - 1] = '\0';
-                        board->n_ghosts++;
-                    }
-                    tok = strtok(NULL, " \t");
+                while (board->n_ghosts < MAX_GHOSTS &&
+                       next_word(&s, line_end, is_blank, board->ghosts_files[board->n_ghosts],
+                                 sizeof(board->ghosts_files[0]))) {
+                    board->n_ghosts++;
                 }
             } else {
                 reading_grid = 1;
@@ -148,49 +242,42 @@ int parse_level_file(const char *path, board_t *board, int *default_pac_x, int *
             // estamos a ler as linhas da grelha do nível
             if (!board->board) {
                 if (board->width <= 0 || board->height <= 0) {
-                    free(buf);
+                    unmap_file(&file);
                     return -1;
                 }
-                board->board = calloc(board->width * board->height, sizeof(board_pos_t));
+                board->board = calloc((size_t)board->width * board->height, sizeof(board_pos_t));
                 if (!board->board) {
                     perror("calloc");
-                    free(buf);
+                    unmap_file(&file);
                     return -1;
                 }
             }
 
             if (grid_row < board->height) {
-                // copia cada caracter da linha para a grelha
-                for (int j = 0; j < board->width && line[j] != '\0'; ++j) {
-                    char ch = line[j];
-                    int idx = grid_row * board->width + j;
-
-                    board->board[idx].content = ' ';
-                    board->board[idx].has_dot = 0;
-                    board->board[idx].has_portal = 0;
-
-                    if (ch == 'X') {
-                        board->board[idx].content = 'W';    //parede
-                    } else if (ch == 'o') {
-                        board->board[idx].has_dot = 1;
-                        // primeira 'o' encontrada pode definir pos default do pacman
-                        if (!found_pac_default) {
-                            *default_pac_x = j;
-                            *default_pac_y = grid_row;
-                            found_pac_default = 1;
-                        }
-                    } else if (ch == '@') {
-                        board->board[idx].has_portal = 1;   //portal
+                // escreve cada caracter da linha diretamente na grelha
+                int n = (int)(line_end - line) < board->width ? (int)(line_end - line) : board->width;
+                board_pos_t *row = &board->board[(size_t)grid_row * board->width];
+                const unsigned char *src = (const unsigned char *)line;
+                int j = 0;
+
+                // primeira 'o' encontrada pode definir pos default do pacman
+                for (; !found_pac_default && j < n; ++j) {
+                    row[j] = grid_cell[src[j]];
+                    if (src[j] == 'o') {
+                        *default_pac_x = j;
+                        *default_pac_y = grid_row;
+                        found_pac_default = 1;
                     }
                 }
+                for (; j < n; ++j) {
+                    row[j] = grid_cell[src[j]];
+                }
                 grid_row++;
             }
         }
-
-        line = strtok_r(NULL, "\n", &saveptr);
     }
 
-    free(buf);
+    unmap_file(&file);
 
     // guarda o nome do nível (caminho do ficheiro) para debug
     strncpy(board->level_name, path, sizeof(board->level_name) - 1);
@@ -201,33 +288,32 @@ int parse_level_file(const char *path, board_t *board, int *default_pac_x, int *
 
 /* Parse .p / .m  */
 int parse_behavior_file(const char *path, int *passo, int *row, int *col, command_t *moves, int *n_moves) {
-    char *buf = NULL;
-    ssize_t len = 0;
-    if (read_entire_file(path, &buf, &len) != 0) return -1;
+    mapped_file_t file;
+    if (map_file(path, &file) != 0) return -1;
 
     int passo_val = 0;
     int r = 0, c = 0;
     int count = 0;
 
-    char *saveptr = NULL;
-    char *line = strtok_r(buf, "\n", &saveptr);
+    const char *pos = file.data;
+    const char *end = file.data + file.len;
+    const char *line, *line_end;
 
-    while (line) {
-        trim(line);
+    while (next_line(&pos, end, &line, &line_end)) {
         // ignora comentários e linhas vazias
-        if (line[0] == '#' || line[0] == '\0') {
-            line = strtok_r(NULL, "\n", &saveptr);
+        if (line == line_end || *line == '#') {
             continue;
         }
 
-        if (strncmp(line, "PASSO", 5) == 0) {
+        const char *s = line;
+        if (match_keyword(&s, line_end, "PASSO")) {
             int tmp;
-            if (sscanf(line, "PASSO %d", &tmp) == 1) {
+            if (parse_int(&s, line_end, &tmp)) {
                 passo_val = tmp;
             }
-        } else if (strncmp(line, "POS", 3) == 0) {
+        } else if (match_keyword(&s, line_end, "POS")) {
             int rr, cc;
-            if (sscanf(line, "POS %d %d", &rr, &cc) == 2) {
+            if (parse_int(&s, line_end, &rr) && parse_int(&s, line_end, &cc)) {
                 r = rr;
                 c = cc;
             }
@@ -238,7 +324,8 @@ int parse_behavior_file(const char *path, int *passo, int *row, int *col, comman
                 if (line[0] == 'T') {
                     int n;
                     // comando "T (numero)", espera (numero) turnos
-                    if (sscanf(line, "T %d", &n) == 1) {
+                    s = line + 1;
+                    if (parse_int(&s, line_end, &n)) {
                         cmd->command = 'T';
                         cmd->turns = n;
                         cmd->turns_left = n;
@@ -253,11 +340,9 @@ int parse_behavior_file(const char *path, int *passo, int *row, int *col, comman
                 }
             }
         }
-
-        line = strtok_r(NULL, "\n", &saveptr);
     }
 
-    free(buf);
+    unmap_file(&file);
 
     if (passo){
         *passo = passo_val;
@@ -273,4 +358,4 @@ int parse_behavior_file(const char *path, int *passo, int *row, int *col, comman
     }
 
     return 0;
-}
\ No newline at end of file
+}
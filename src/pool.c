@@ -0,0 +1,152 @@
+#include "pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct {
+    pool_t* pool;
+    int worker_index;
+} pool_worker_arg_t;
+
+int pool_init(pool_t* pool, int n_workers) {
+    if (n_workers < 1) {
+        n_workers = 1;
+    }
+    pool->n_workers = n_workers;
+    pool->next_deque = 0;
+    pool->deques = calloc(n_workers, sizeof(pool_deque_t));
+    pool->steals = calloc(n_workers, sizeof(unsigned long));
+    if (!pool->deques || !pool->steals) {
+        perror("calloc pool");
+        free(pool->deques);
+        free(pool->steals);
+        return -1;
+    }
+    for (int w = 0; w < n_workers; w++) {
+        pthread_mutex_init(&pool->deques[w].lock, NULL);
+    }
+    return 0;
+}
+
+int pool_submit(pool_t* pool, void (*run)(void* arg), void* arg) {
+    pool_deque_t* dq = &pool->deques[pool->next_deque];
+    pool->next_deque = (pool->next_deque + 1) % pool->n_workers;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->capacity) {
+        int capacity = dq->capacity ? dq->capacity * 2 : 16;
+        pool_task_t* tasks = realloc(dq->tasks, (size_t)capacity * sizeof(pool_task_t));
+        if (!tasks) {
+            pthread_mutex_unlock(&dq->lock);
+            perror("realloc pool tasks");
+            return -1;
+        }
+        dq->tasks = tasks;
+        dq->capacity = capacity;
+    }
+    dq->tasks[dq->tail].run = run;
+    dq->tasks[dq->tail].arg = arg;
+    dq->tail++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+// Newest task of the worker's own deque
+static int pop_own(pool_deque_t* dq, pool_task_t* task) {
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) {
+        *task = dq->tasks[--dq->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+// Oldest task of someone else's deque
+static int steal(pool_deque_t* dq, pool_task_t* task) {
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) {
+        *task = dq->tasks[dq->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static void* pool_worker(void* arg) {
+    pool_worker_arg_t* warg = arg;
+    pool_t* pool = warg->pool;
+    int w = warg->worker_index;
+    free(warg);
+
+    pool_task_t task;
+    while (1) {
+        if (pop_own(&pool->deques[w], &task)) {
+            task.run(task.arg);
+            continue;
+        }
+
+        // tasks never spawn tasks, so a full round with nothing to steal means we are done
+        int stolen = 0;
+        for (int i = 1; i < pool->n_workers && !stolen; i++) {
+            stolen = steal(&pool->deques[(w + i) % pool->n_workers], &task);
+        }
+        if (!stolen) {
+            break;
+        }
+        pool->steals[w]++;
+        task.run(task.arg);
+    }
+    return NULL;
+}
+
+int pool_run(pool_t* pool) {
+    pthread_t* threads = calloc(pool->n_workers, sizeof(pthread_t));
+    if (!threads) {
+        perror("calloc pool threads");
+        return -1;
+    }
+
+    int created = 0;
+    for (int w = 0; w < pool->n_workers; w++) {
+        pool_worker_arg_t* warg = malloc(sizeof(pool_worker_arg_t));
+        if (!warg) {
+            break;
+        }
+        warg->pool = pool;
+        warg->worker_index = w;
+        if (pthread_create(&threads[w], NULL, pool_worker, warg) != 0) {
+            free(warg);
+            break;
+        }
+        created++;
+    }
+
+    // workers that failed to start leave their deques to be stolen by the others
+    if (created < pool->n_workers) {
+        fprintf(stderr, "Erro a criar os workers da pool, a usar %d\n", created);
+    }
+    if (created == 0) {
+        free(threads);
+        return -1;
+    }
+
+    for (int w = 0; w < created; w++) {
+        pthread_join(threads[w], NULL);
+    }
+    free(threads);
+    return 0;
+}
+
+void pool_destroy(pool_t* pool) {
+    for (int w = 0; w < pool->n_workers; w++) {
+        pthread_mutex_destroy(&pool->deques[w].lock);
+        free(pool->deques[w].tasks);
+    }
+    free(pool->deques);
+    free(pool->steals);
+    pool->deques = NULL;
+    pool->steals = NULL;
+    pool->n_workers = 0;
+}
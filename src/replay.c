@@ -0,0 +1,206 @@
+#include "engine.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    unsigned long ticks;        // ticks replayed
+    unsigned long keyframes;    // keyframes checked or loaded
+    unsigned long mismatches;   // ticks/keyframes where the replay differs from the trace
+    long first_mismatch;        // session tick of the first one, -1 if none
+} replay_stats_t;
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void mismatch(replay_stats_t* stats, unsigned long tick, const char* what) {
+    if (stats->first_mismatch < 0) {
+        stats->first_mismatch = (long)tick;
+        fprintf(stderr, "replay differs from the trace at tick %lu (%s)\n", tick, what);
+    }
+    stats->mismatches++;
+}
+
+static int loaded_level(const engine_t* engine) {
+    return engine->loaded ? engine->board.levels->current - 1 : -1;
+}
+
+static trace_result_t result_of(engine_status_t status) {
+    switch (status) {
+        case ENGINE_LEVEL_DONE:  return TRACE_PORTAL;
+        case ENGINE_PACMAN_DEAD: return TRACE_DEAD;
+        default:                 return TRACE_CONTINUE;
+    }
+}
+
+// The board as the level files write it, for the state at a seek target
+static void print_grid(const board_t* board) {
+    for (int y = 0; y < board->height; y++) {
+        for (int x = 0; x < board->width; x++) {
+            board_pos_t cell = board->board[y * board->width + x];
+            char c = ' ';
+            switch (cell & CELL_OCCUPANT_MASK) {
+                case CELL_WALL:   c = 'X'; break;
+                case CELL_PACMAN: c = 'C'; break;
+                case CELL_GHOST:  c = 'M'; break;
+                default:
+                    if (cell & CELL_PORTAL) c = '@';
+                    else if (cell & CELL_DOT) c = '.';
+            }
+            putchar(c);
+        }
+        putchar('\n');
+    }
+}
+
+static void usage(const char* prog) {
+    printf("Usage: %s [-d level_directory] [-m direct|intent] [-s tick] <trace>\n", prog);
+}
+
+int main(int argc, char** argv) {
+    const char* level_dir = NULL;
+    int has_mode = 0;
+    sched_mode_t sched_mode = SCHED_DIRECT;
+    int has_target = 0;
+    unsigned long target = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:m:s:")) != -1) {
+        switch (opt) {
+            case 'd':
+                level_dir = optarg;
+                break;
+            case 'm':
+                if (scheduler_parse_mode(optarg, &sched_mode) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                has_mode = 1;
+                break;
+            case 's':
+                target = strtoul(optarg, NULL, 10);
+                has_target = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    trace_reader_t trace;
+    if (trace_open_read(&trace, argv[optind]) != 0) {
+        return 1;
+    }
+    if (!level_dir) {
+        level_dir = trace.level_dir;
+    }
+    if (!has_mode) {
+        sched_mode = (sched_mode_t)trace.sched_mode;
+    }
+
+    // no workers: a replay must play the ghosts in a fixed order
+    engine_t engine;
+    if (engine_init(&engine, level_dir, 0, sched_mode) != 0) {
+        printf("Error: could not load levels from directory '%s'\n", level_dir);
+        trace_close_read(&trace);
+        return 1;
+    }
+
+    if (has_target) {
+        // straight to the closest keyframe, only the ticks after it are simulated
+        trace_seek(&trace, target);
+    }
+
+    replay_stats_t stats = {0, 0, 0, -1};
+    board_snapshot_t snap;
+    memset(&snap, 0, sizeof(snap));
+    trace_buf_t state = {0};
+    int synced = 0;             // 0 until a keyframe was loaded into the engine
+    unsigned long at = 0;       // session tick the engine is at
+    int ret = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    trace_record_t rec;
+    while (trace_next(&trace, &rec)) {
+        if (rec.type == TRACE_KEYFRAME) {
+            stats.keyframes++;
+            if (loaded_level(&engine) != rec.level) {
+                if (engine_load_level(&engine, rec.level) != 0) {
+                    fprintf(stderr, "trace needs level %d, not in '%s'\n", rec.level, level_dir);
+                    ret = 1;
+                    break;
+                }
+                synced = 0;
+            }
+
+            if (rec.forced || !synced) {
+                // the state jumped (new level, restore, rewind): take it from the trace
+                if (board_snapshot(&engine.board, &snap) != 0 ||
+                    trace_decode_state(rec.state, rec.state_len, &snap) != 0 ||
+                    engine_restore(&engine, &snap) != 0) {
+                    fprintf(stderr, "bad keyframe at tick %lu\n", rec.tick);
+                    ret = 1;
+                    break;
+                }
+                synced = 1;
+                at = rec.tick;
+            } else {
+                // a periodic keyframe must match the replayed board byte for byte
+                state.len = 0;
+                if (trace_encode_state(&state, &engine.board) != 0 || state.len != rec.state_len ||
+                    memcmp(state.data, rec.state, state.len) != 0) {
+                    mismatch(&stats, rec.tick, "keyframe");
+                }
+            }
+        } else if (rec.type == TRACE_TICK) {
+            if (has_target && rec.tick > target) {
+                break;
+            }
+            if (!synced) {
+                continue;
+            }
+
+            const pacman_t* pac = &engine.board.pacmans[0];
+            int x = pac->pos_x, y = pac->pos_y, points = pac->points;
+            uint64_t rng = board_rng_digest(&engine.board);
+
+            engine_status_t status = engine_step(&engine, rec.input);
+            stats.ticks++;
+            at = rec.tick;
+
+            pac = &engine.board.pacmans[0];
+            if (result_of(status) != rec.result || pac->pos_x - x != rec.dx || pac->pos_y - y != rec.dy ||
+                pac->points - points != rec.dpoints || (board_rng_digest(&engine.board) != rng) != rec.rng_changed) {
+                mismatch(&stats, rec.tick, "tick");
+            }
+        }
+        // the events only say why a forced keyframe follows
+    }
+    double secs = elapsed_seconds(&start);
+
+    if (has_target && engine.loaded) {
+        printf("tick=%lu level=%s points=%d\n", at, engine.board.level_name, engine_points(&engine));
+        print_grid(&engine.board);
+    }
+    printf("ticks=%lu keyframes=%lu mismatches=%lu first_mismatch=%ld seconds=%.6f ticks_per_second=%.0f\n",
+           stats.ticks, stats.keyframes, stats.mismatches, stats.first_mismatch,
+           secs, secs > 0 ? stats.ticks / secs : 0.0);
+
+    trace_buf_free(&state);
+    board_snapshot_free(&snap);
+    engine_destroy(&engine);
+    trace_close_read(&trace);
+    return (ret != 0 || stats.mismatches) ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+#include "scheduler.h"
+#include "board.h"
+#include "history.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    scheduler_t* sched;
+    int worker_index;
+} worker_arg_t;
+
+static inline void play_ghost(board_t* board, int ghost_index) {
+    ghost_t* ghost = &board->ghosts[ghost_index];
+    if (ghost->n_moves == 0) {
+        return;
+    }
+    move_ghost(board, ghost_index, &ghost->moves[ghost->current_move % ghost->n_moves]);
+}
+
+static inline void plan_ghost_play(scheduler_t* sched, int ghost_index) {
+    board_t* board = sched->board;
+    ghost_t* ghost = &board->ghosts[ghost_index];
+    if (ghost->n_moves == 0) {
+        return;
+    }
+    plan_ghost(board, ghost_index, &ghost->moves[ghost->current_move % ghost->n_moves],
+               &sched->intents[ghost_index]);
+}
+
+// Worker 'w' plays (or plans) ghosts w, w + n_workers, w + 2*n_workers, ... of every tick
+static void* scheduler_worker(void* arg) {
+    worker_arg_t* warg = arg;
+    scheduler_t* sched = warg->sched;
+    int w = warg->worker_index;
+    free(warg);
+
+    unsigned long seen = 0;
+
+    while (1) {
+        prof_mutex_lock(&sched->barrier_lock);
+        while (sched->generation == seen && !sched->stop) {
+            prof_cond_wait(&sched->start, &sched->barrier_lock);
+        }
+        if (sched->stop) {
+            prof_mutex_unlock(&sched->barrier_lock);
+            break;
+        }
+        seen = sched->generation;
+        prof_mutex_unlock(&sched->barrier_lock);
+
+        board_t* board = sched->board;
+        uint64_t started = metrics_clock();
+        if (sched->mode == SCHED_INTENT) {
+            // nothing writes the board until every plan is in
+            for (int i = w; i < board->n_ghosts; i += sched->n_workers) {
+                plan_ghost_play(sched, i);
+            }
+        } else {
+            // move_ghost only locks the region of the board each move touches
+            for (int i = w; i < board->n_ghosts; i += sched->n_workers) {
+                play_ghost(board, i);
+            }
+        }
+        metrics_count(METRIC_WORKER_SHARES, 1);
+        metrics_elapsed(METRIC_WORKER_SHARE_NS, started);
+
+        // barrier: the tick only ends when every worker got here
+        prof_mutex_lock(&sched->barrier_lock);
+        sched->finished++;
+        pthread_cond_signal(&sched->done);
+        prof_mutex_unlock(&sched->barrier_lock);
+    }
+    return NULL;
+}
+
+int scheduler_parse_mode(const char* name, sched_mode_t* mode) {
+    if (strcmp(name, "direct") == 0) {
+        *mode = SCHED_DIRECT;
+    } else if (strcmp(name, "intent") == 0) {
+        *mode = SCHED_INTENT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int scheduler_init(scheduler_t* sched, board_t* board, int n_workers, sched_mode_t mode) {
+    sched->board = board;
+    sched->mode = mode;
+    sched->tick = 0;
+    sched->n_workers = 0;
+    sched->workers = NULL;
+    sched->generation = 0;
+    sched->finished = 0;
+    sched->stop = 0;
+
+    if (n_workers <= 0) {
+        return 0;
+    }
+
+    sched->workers = calloc(n_workers, sizeof(pthread_t));
+    if (!sched->workers) {
+        perror("calloc scheduler workers");
+        return -1;
+    }
+    if (mode == SCHED_DIRECT && board_enable_locks(board) != 0) {
+        free(sched->workers);
+        sched->workers = NULL;
+        return -1;
+    }
+
+    prof_mutex_init(&sched->barrier_lock, "scheduler barrier");
+    pthread_cond_init(&sched->start, NULL);
+    pthread_cond_init(&sched->done, NULL);
+
+    int created = 0;
+    for (int w = 0; w < n_workers; w++) {
+        worker_arg_t* warg = malloc(sizeof(worker_arg_t));
+        if (!warg) {
+            break;
+        }
+        warg->sched = sched;
+        warg->worker_index = w;
+        if (pthread_create(&sched->workers[w], NULL, scheduler_worker, warg) != 0) {
+            free(warg);
+            break;
+        }
+        created++;
+    }
+
+    // the workers only read n_workers once a tick is published, so the pool can shrink here
+    if (created < n_workers) {
+        fprintf(stderr, "Erro a criar os workers do scheduler, a usar %d\n", created);
+    }
+    sched->n_workers = created;
+    return 0;
+}
+
+// Hands the current tick to the workers and waits for all of them
+static void run_workers(scheduler_t* sched) {
+    prof_mutex_lock(&sched->barrier_lock);
+    sched->finished = 0;
+    sched->generation++;
+    pthread_cond_broadcast(&sched->start);
+    while (sched->finished < sched->n_workers) {
+        prof_cond_wait(&sched->done, &sched->barrier_lock);
+    }
+    prof_mutex_unlock(&sched->barrier_lock);
+}
+
+// Intent tick: plans are made against the board as the ghost phase starts and committed
+// in index order, so a lower index wins when two ghosts want the same cell
+static void play_ghosts_intent(scheduler_t* sched) {
+    board_t* board = sched->board;
+
+    // 'R' plans draw from the ghost's own rng, so they can be made in any order
+    if (sched->n_workers == 0) {
+        for (int i = 0; i < board->n_ghosts; i++) {
+            plan_ghost_play(sched, i);
+        }
+    } else {
+        run_workers(sched);
+    }
+
+    for (int i = 0; i < board->n_ghosts; i++) {
+        ghost_t* ghost = &board->ghosts[i];
+        if (ghost->n_moves == 0) {
+            continue;
+        }
+        commit_ghost(board, i, &ghost->moves[ghost->current_move % ghost->n_moves], &sched->intents[i]);
+    }
+}
+
+static void play_ghosts(scheduler_t* sched) {
+    board_t* board = sched->board;
+
+    if (sched->mode == SCHED_INTENT) {
+        play_ghosts_intent(sched);
+        return;
+    }
+
+    if (sched->n_workers == 0) {
+        // defined order: ghost 0, 1, 2, ...
+        for (int i = 0; i < board->n_ghosts; i++) {
+            play_ghost(board, i);
+        }
+        return;
+    }
+
+    run_workers(sched);
+}
+
+int scheduler_tick(scheduler_t* sched, command_t* pacman_play) {
+    board_t* board = sched->board;
+    int result = VALID_MOVE;
+
+    sched->tick++;
+
+    if (pacman_play) {
+        result = move_pacman(board, 0, pacman_play);
+    }
+
+    if (result != REACHED_PORTAL) {
+        // one BFS for every chasing ghost of the tick, only if the pacman moved
+        board_update_chase(board);
+        play_ghosts(sched);
+    }
+
+    // the tick is over, whatever it wrote becomes one history entry
+    if (board->history) {
+        history_commit(board->history, board);
+    }
+
+    return result;
+}
+
+void scheduler_destroy(scheduler_t* sched) {
+    if (sched->workers) {
+        prof_mutex_lock(&sched->barrier_lock);
+        sched->stop = 1;
+        pthread_cond_broadcast(&sched->start);
+        prof_mutex_unlock(&sched->barrier_lock);
+
+        for (int w = 0; w < sched->n_workers; w++) {
+            pthread_join(sched->workers[w], NULL);
+        }
+
+        pthread_cond_destroy(&sched->start);
+        pthread_cond_destroy(&sched->done);
+        prof_mutex_destroy(&sched->barrier_lock);
+        free(sched->workers);
+        if (sched->mode == SCHED_DIRECT) board_disable_locks(sched->board);
+    }
+    sched->workers = NULL;
+    sched->n_workers = 0;
+    sched->board = NULL;
+}
@@ -0,0 +1,601 @@
+#include "trace.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// TICK flags: result in the two low bits, then which optional fields follow
+#define TICK_RESULT_MASK 0x03
+#define TICK_INPUT       0x04
+#define TICK_MOVED       0x08
+#define TICK_POINTS      0x10
+#define TICK_RNG         0x20
+
+// ENCODING
+
+static void buf_reserve(trace_buf_t* buf, size_t n) {
+    if (buf->failed || buf->len + n <= buf->cap) {
+        return;
+    }
+    size_t cap = buf->cap ? buf->cap : 256;
+    while (cap < buf->len + n) {
+        cap *= 2;
+    }
+    unsigned char* data = realloc(buf->data, cap);
+    if (!data) {
+        perror("realloc trace buffer");
+        buf->failed = 1;
+        return;
+    }
+    buf->data = data;
+    buf->cap = cap;
+}
+
+static void put_byte(trace_buf_t* buf, unsigned char byte) {
+    buf_reserve(buf, 1);
+    if (!buf->failed) {
+        buf->data[buf->len++] = byte;
+    }
+}
+
+static void put_bytes(trace_buf_t* buf, const void* bytes, size_t n) {
+    buf_reserve(buf, n);
+    if (!buf->failed) {
+        memcpy(buf->data + buf->len, bytes, n);
+        buf->len += n;
+    }
+}
+
+static void put_uvar(trace_buf_t* buf, uint64_t value) {
+    while (value >= 0x80) {
+        put_byte(buf, (unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    put_byte(buf, (unsigned char)value);
+}
+
+// zigzag: small negative numbers stay small
+static void put_int(trace_buf_t* buf, long value) {
+    put_uvar(buf, ((uint64_t)value << 1) ^ (uint64_t)(value >> (sizeof(long) * CHAR_BIT - 1)));
+}
+
+static void put_moves(trace_buf_t* buf, const command_t* moves, int n_moves) {
+    put_int(buf, n_moves);
+    for (int i = 0; i < n_moves && i < MAX_MOVES; i++) {
+        put_byte(buf, (unsigned char)moves[i].command);
+        put_int(buf, moves[i].turns);
+        put_int(buf, moves[i].turns_left);
+    }
+}
+
+int trace_encode_state(trace_buf_t* buf, const board_t* board) {
+    put_uvar(buf, board->levels ? (uint64_t)(board->levels->current - 1) : 0);
+    put_uvar(buf, (uint64_t)board->width);
+    put_uvar(buf, (uint64_t)board->height);
+
+    // the grid as runs of equal cells, mostly dots and walls
+    int n_cells = board->width * board->height;
+    for (int i = 0; i < n_cells;) {
+        int run = 1;
+        while (i + run < n_cells && board->board[i + run] == board->board[i]) {
+            run++;
+        }
+        put_uvar(buf, (uint64_t)run);
+        put_byte(buf, board->board[i]);
+        i += run;
+    }
+
+    put_uvar(buf, (uint64_t)board->n_pacmans);
+    for (int i = 0; i < board->n_pacmans; i++) {
+        const pacman_t* pac = &board->pacmans[i];
+        put_int(buf, pac->pos_x);
+        put_int(buf, pac->pos_y);
+        put_int(buf, pac->alive);
+        put_int(buf, pac->points);
+        put_int(buf, pac->passo);
+        put_int(buf, pac->waiting);
+        put_int(buf, pac->current_move);
+        put_uvar(buf, pac->rng);
+        put_moves(buf, pac->moves, pac->n_moves);
+    }
+
+    put_uvar(buf, (uint64_t)board->n_ghosts);
+    for (int i = 0; i < board->n_ghosts; i++) {
+        const ghost_t* ghost = &board->ghosts[i];
+        put_int(buf, ghost->pos_x);
+        put_int(buf, ghost->pos_y);
+        put_int(buf, ghost->passo);
+        put_int(buf, ghost->waiting);
+        put_int(buf, ghost->current_move);
+        put_int(buf, ghost->charged);
+        put_uvar(buf, ghost->rng);
+        put_moves(buf, ghost->moves, ghost->n_moves);
+    }
+
+    return buf->failed ? -1 : 0;
+}
+
+// DECODING
+
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    int bad;                    // ran past the end or found garbage
+} cursor_t;
+
+static unsigned char get_byte(cursor_t* c) {
+    if (c->p >= c->end) {
+        c->bad = 1;
+        return 0;
+    }
+    return *c->p++;
+}
+
+static uint64_t get_uvar(cursor_t* c) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        unsigned char byte = get_byte(c);
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    c->bad = 1;
+    return 0;
+}
+
+static long get_int(cursor_t* c) {
+    uint64_t value = get_uvar(c);
+    return (long)(value >> 1) ^ -(long)(value & 1);
+}
+
+static int get_moves(cursor_t* c, command_t* moves) {
+    int n_moves = (int)get_int(c);
+    if (n_moves < 0 || n_moves > MAX_MOVES) {
+        c->bad = 1;
+        return 0;
+    }
+    for (int i = 0; i < n_moves; i++) {
+        moves[i].command = (char)get_byte(c);
+        moves[i].turns = (int)get_int(c);
+        moves[i].turns_left = (int)get_int(c);
+    }
+    return n_moves;
+}
+
+int trace_decode_state(const unsigned char* state, size_t len, board_snapshot_t* snap) {
+    cursor_t c = {state, state + len, 0};
+    board_t* board = &snap->board;
+
+    snap->level_cursor = (int)get_uvar(&c) + 1;
+    int width = (int)get_uvar(&c);
+    int height = (int)get_uvar(&c);
+    if (width != board->width || height != board->height) {
+        return -1;      // not the level the snapshot was taken from
+    }
+
+    int n_cells = width * height;
+    for (int i = 0; i < n_cells && !c.bad;) {
+        int run = (int)get_uvar(&c);
+        board_pos_t cell = get_byte(&c);
+        if (run <= 0 || run > n_cells - i) {
+            return -1;
+        }
+        memset(&board->board[i], cell, (size_t)run * sizeof(board_pos_t));
+        i += run;
+    }
+
+    if ((int)get_uvar(&c) != board->n_pacmans) {
+        return -1;
+    }
+    for (int i = 0; i < board->n_pacmans && !c.bad; i++) {
+        pacman_t* pac = &board->pacmans[i];
+        pac->pos_x = (int)get_int(&c);
+        pac->pos_y = (int)get_int(&c);
+        pac->alive = (int)get_int(&c);
+        pac->points = (int)get_int(&c);
+        pac->passo = (int)get_int(&c);
+        pac->waiting = (int)get_int(&c);
+        pac->current_move = (int)get_int(&c);
+        pac->rng = get_uvar(&c);
+        pac->n_moves = get_moves(&c, pac->moves);
+    }
+
+    if ((int)get_uvar(&c) != board->n_ghosts) {
+        return -1;
+    }
+    for (int i = 0; i < board->n_ghosts && !c.bad; i++) {
+        ghost_t* ghost = &board->ghosts[i];
+        ghost->pos_x = (int)get_int(&c);
+        ghost->pos_y = (int)get_int(&c);
+        ghost->passo = (int)get_int(&c);
+        ghost->waiting = (int)get_int(&c);
+        ghost->current_move = (int)get_int(&c);
+        ghost->charged = (int)get_int(&c);
+        ghost->rng = get_uvar(&c);
+        ghost->n_moves = get_moves(&c, ghost->moves);
+    }
+
+    return (c.bad || c.p != c.end) ? -1 : 0;
+}
+
+void trace_buf_free(trace_buf_t* buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+// WRITER
+
+static void emit(trace_writer_t* trace) {
+    if (!trace->f || trace->buf.failed) {
+        trace->buf.len = 0;
+        trace->buf.failed = 0;
+        return;
+    }
+    // stdio buffers the records, the game loop does not pay a syscall per tick
+    fwrite(trace->buf.data, 1, trace->buf.len, trace->f);
+    trace->offset += (long)trace->buf.len;
+    trace->buf.len = 0;
+}
+
+int trace_open_write(trace_writer_t* trace, const char* path, const char* level_dir, int sched_mode) {
+    memset(trace, 0, sizeof(*trace));
+    trace->keyframe_interval = TRACE_KEYFRAME_INTERVAL;
+    trace->f = fopen(path, "wb");
+    if (!trace->f) {
+        perror("fopen trace");
+        return -1;
+    }
+
+    put_bytes(&trace->buf, TRACE_MAGIC, 8);
+    put_uvar(&trace->buf, TRACE_VERSION);
+    put_uvar(&trace->buf, (uint64_t)trace->keyframe_interval);
+    put_uvar(&trace->buf, (uint64_t)sched_mode);
+    put_uvar(&trace->buf, strlen(level_dir));
+    put_bytes(&trace->buf, level_dir, strlen(level_dir));
+    emit(trace);
+    return 0;
+}
+
+void trace_tick(trace_writer_t* trace, const board_t* board, char input, trace_result_t result) {
+    const pacman_t* pac = &board->pacmans[0];
+    int dx = pac->pos_x - trace->last_x;
+    int dy = pac->pos_y - trace->last_y;
+    int dpoints = pac->points - trace->last_points;
+
+    unsigned char flags = (unsigned char)result;
+    if (input != '\0') flags |= TICK_INPUT;
+    if (dx != 0 || dy != 0) flags |= TICK_MOVED;
+    if (dpoints != 0) flags |= TICK_POINTS;
+    uint64_t rng = board_rng_digest(board);
+    if (rng != trace->last_rng) flags |= TICK_RNG;
+
+    // usually two bytes: type and flags
+    put_byte(&trace->buf, TRACE_TICK);
+    put_byte(&trace->buf, flags);
+    if (flags & TICK_INPUT) {
+        put_byte(&trace->buf, (unsigned char)input);
+    }
+    if (flags & TICK_MOVED) {
+        put_int(&trace->buf, dx);
+        put_int(&trace->buf, dy);
+    }
+    if (flags & TICK_POINTS) {
+        put_int(&trace->buf, dpoints);
+    }
+    emit(trace);
+
+    trace->last_x = pac->pos_x;
+    trace->last_y = pac->pos_y;
+    trace->last_points = pac->points;
+    trace->last_rng = rng;
+    trace->tick++;
+
+    if (trace->tick % (unsigned long)trace->keyframe_interval == 0) {
+        trace_keyframe(trace, board, 0);
+    }
+}
+
+void trace_keyframe(trace_writer_t* trace, const board_t* board, int forced) {
+    trace_buf_t state = {0};
+    if (trace_encode_state(&state, board) != 0) {
+        trace_buf_free(&state);
+        return;
+    }
+
+    if (trace->n_index == trace->index_capacity) {
+        int capacity = trace->index_capacity ? trace->index_capacity * 2 : 64;
+        trace_keyframe_ref_t* index = realloc(trace->index, (size_t)capacity * sizeof(trace_keyframe_ref_t));
+        if (!index) {
+            perror("realloc trace index");
+            trace_buf_free(&state);
+            return;
+        }
+        trace->index = index;
+        trace->index_capacity = capacity;
+    }
+    trace->index[trace->n_index].tick = trace->tick;
+    trace->index[trace->n_index].offset = trace->offset;
+    trace->n_index++;
+
+    put_byte(&trace->buf, TRACE_KEYFRAME);
+    put_byte(&trace->buf, forced ? 1 : 0);
+    put_uvar(&trace->buf, trace->tick);
+    put_uvar(&trace->buf, state.len);
+    put_bytes(&trace->buf, state.data, state.len);
+    emit(trace);
+    trace_buf_free(&state);
+
+    // the next tick deltas start from this state
+    trace->last_x = board->pacmans[0].pos_x;
+    trace->last_y = board->pacmans[0].pos_y;
+    trace->last_points = board->pacmans[0].points;
+    trace->last_rng = board_rng_digest(board);
+}
+
+void trace_event(trace_writer_t* trace, trace_event_t event, unsigned long arg) {
+    put_byte(&trace->buf, TRACE_EVENT);
+    put_byte(&trace->buf, (unsigned char)event);
+    put_uvar(&trace->buf, arg);
+    emit(trace);
+}
+
+int trace_close_write(trace_writer_t* trace) {
+    if (!trace->f) {
+        return -1;
+    }
+
+    long index_offset = trace->offset;
+    put_byte(&trace->buf, TRACE_INDEX);
+    put_uvar(&trace->buf, (uint64_t)trace->n_index);
+    unsigned long tick = 0;
+    long offset = 0;
+    for (int i = 0; i < trace->n_index; i++) {
+        put_uvar(&trace->buf, trace->index[i].tick - tick);
+        put_uvar(&trace->buf, (uint64_t)(trace->index[i].offset - offset));
+        tick = trace->index[i].tick;
+        offset = trace->index[i].offset;
+    }
+
+    // fixed size footer, found from the end of the file
+    unsigned char footer[8];
+    for (int i = 0; i < 8; i++) {
+        footer[i] = (unsigned char)((uint64_t)index_offset >> (8 * i));
+    }
+    put_bytes(&trace->buf, footer, sizeof(footer));
+    put_bytes(&trace->buf, TRACE_INDEX_MAGIC, 8);
+    emit(trace);
+
+    int ret = fclose(trace->f) == 0 ? 0 : -1;
+    trace->f = NULL;
+    free(trace->index);
+    trace->index = NULL;
+    trace_buf_free(&trace->buf);
+    return ret;
+}
+
+// READER
+
+static int read_uvar(FILE* f, uint64_t* value) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = getc(f);
+        if (byte == EOF) {
+            return -1;
+        }
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int read_int(FILE* f, int* value) {
+    uint64_t v;
+    if (read_uvar(f, &v) != 0) {
+        return -1;
+    }
+    *value = (int)((long)(v >> 1) ^ -(long)(v & 1));
+    return 0;
+}
+
+static int add_index(trace_reader_t* trace, int* capacity, unsigned long tick, long offset) {
+    if (trace->n_index == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        trace_keyframe_ref_t* index = realloc(trace->index, (size_t)*capacity * sizeof(trace_keyframe_ref_t));
+        if (!index) {
+            perror("realloc trace index");
+            return -1;
+        }
+        trace->index = index;
+    }
+    trace->index[trace->n_index].tick = tick;
+    trace->index[trace->n_index].offset = offset;
+    trace->n_index++;
+    return 0;
+}
+
+// INDEX record written by trace_close_write, -1 if the trace has none
+static int read_index(trace_reader_t* trace) {
+    unsigned char footer[16];
+    if (fseek(trace->f, -16, SEEK_END) != 0 || fread(footer, 1, sizeof(footer), trace->f) != sizeof(footer) ||
+        memcmp(footer + 8, TRACE_INDEX_MAGIC, 8) != 0) {
+        return -1;
+    }
+    uint64_t index_offset = 0;
+    for (int i = 0; i < 8; i++) {
+        index_offset |= (uint64_t)footer[i] << (8 * i);
+    }
+
+    uint64_t n;
+    if (fseek(trace->f, (long)index_offset, SEEK_SET) != 0 || getc(trace->f) != TRACE_INDEX ||
+        read_uvar(trace->f, &n) != 0) {
+        return -1;
+    }
+
+    int capacity = 0;
+    unsigned long tick = 0;
+    long offset = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t dtick, doffset;
+        if (read_uvar(trace->f, &dtick) != 0 || read_uvar(trace->f, &doffset) != 0) {
+            return -1;
+        }
+        tick += dtick;
+        offset += (long)doffset;
+        if (add_index(trace, &capacity, tick, offset) != 0) {
+            return -1;
+        }
+    }
+    trace->end = (long)index_offset;
+    return 0;
+}
+
+// No footer: the records are walked once to find the keyframes
+static int rebuild_index(trace_reader_t* trace) {
+    free(trace->index);
+    trace->index = NULL;
+    trace->n_index = 0;
+    trace->end = LONG_MAX;
+    fseek(trace->f, trace->start, SEEK_SET);
+
+    int capacity = 0;
+    trace_record_t rec;
+    long offset = trace->start;
+    while (trace_next(trace, &rec)) {
+        if (rec.type == TRACE_KEYFRAME && add_index(trace, &capacity, rec.tick, offset) != 0) {
+            return -1;
+        }
+        offset = ftell(trace->f);
+    }
+    // a record cut short by a crash is not replayed
+    trace->end = offset;
+    return 0;
+}
+
+int trace_open_read(trace_reader_t* trace, const char* path) {
+    memset(trace, 0, sizeof(*trace));
+    trace->f = fopen(path, "rb");
+    if (!trace->f) {
+        perror("fopen trace");
+        return -1;
+    }
+
+    char magic[8];
+    uint64_t version, interval, mode, dir_len;
+    if (fread(magic, 1, sizeof(magic), trace->f) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, 8) != 0 ||
+        read_uvar(trace->f, &version) != 0 || version != TRACE_VERSION ||
+        read_uvar(trace->f, &interval) != 0 || read_uvar(trace->f, &mode) != 0 ||
+        read_uvar(trace->f, &dir_len) != 0 || dir_len >= sizeof(trace->level_dir) ||
+        fread(trace->level_dir, 1, dir_len, trace->f) != dir_len) {
+        fprintf(stderr, "%s is not a trace (version %d)\n", path, TRACE_VERSION);
+        trace_close_read(trace);
+        return -1;
+    }
+    trace->level_dir[dir_len] = '\0';
+    trace->keyframe_interval = (int)interval;
+    trace->sched_mode = (int)mode;
+    trace->start = ftell(trace->f);
+
+    if (read_index(trace) != 0 && rebuild_index(trace) != 0) {
+        trace_close_read(trace);
+        return -1;
+    }
+
+    fseek(trace->f, trace->start, SEEK_SET);
+    trace->tick = 0;
+    return 0;
+}
+
+int trace_next(trace_reader_t* trace, trace_record_t* rec) {
+    if (ftell(trace->f) >= trace->end) {
+        return 0;
+    }
+    int type = getc(trace->f);
+    int flags;
+    uint64_t tick, len, arg;
+    memset(rec, 0, sizeof(*rec));
+    rec->type = (trace_record_type_t)type;
+
+    switch (type) {
+        case TRACE_TICK:
+            if ((flags = getc(trace->f)) == EOF) {
+                return 0;
+            }
+            rec->result = (trace_result_t)(flags & TICK_RESULT_MASK);
+            rec->rng_changed = (flags & TICK_RNG) != 0;
+            if (flags & TICK_INPUT) {
+                int input = getc(trace->f);
+                if (input == EOF) {
+                    return 0;
+                }
+                rec->input = (char)input;
+            }
+            if ((flags & TICK_MOVED) && (read_int(trace->f, &rec->dx) != 0 || read_int(trace->f, &rec->dy) != 0)) {
+                return 0;
+            }
+            if ((flags & TICK_POINTS) && read_int(trace->f, &rec->dpoints) != 0) {
+                return 0;
+            }
+            rec->tick = ++trace->tick;
+            return 1;
+
+        case TRACE_KEYFRAME: {
+            int forced = getc(trace->f);
+            if (forced == EOF || read_uvar(trace->f, &tick) != 0 || read_uvar(trace->f, &len) != 0) {
+                return 0;
+            }
+            trace->state.len = 0;
+            buf_reserve(&trace->state, len);
+            if (trace->state.failed || fread(trace->state.data, 1, len, trace->f) != len) {
+                return 0;
+            }
+            cursor_t c = {trace->state.data, trace->state.data + len, 0};
+            rec->level = (int)get_uvar(&c);
+            rec->forced = forced;
+            rec->state = trace->state.data;
+            rec->state_len = len;
+            rec->tick = trace->tick = tick;
+            return !c.bad;
+        }
+
+        case TRACE_EVENT: {
+            int event = getc(trace->f);
+            if (event == EOF || read_uvar(trace->f, &arg) != 0) {
+                return 0;
+            }
+            rec->event = (trace_event_t)event;
+            rec->arg = arg;
+            rec->tick = trace->tick;
+            return 1;
+        }
+
+        default:
+            return 0;   // INDEX, end of file or garbage
+    }
+}
+
+int trace_seek(trace_reader_t* trace, unsigned long tick) {
+    int found = -1;
+    for (int i = 0; i < trace->n_index && trace->index[i].tick <= tick; i++) {
+        found = i;
+    }
+    if (found < 0) {
+        trace->tick = 0;
+        return fseek(trace->f, trace->start, SEEK_SET);
+    }
+    trace->tick = trace->index[found].tick;
+    return fseek(trace->f, trace->index[found].offset, SEEK_SET);
+}
+
+void trace_close_read(trace_reader_t* trace) {
+    if (trace->f) {
+        fclose(trace->f);
+        trace->f = NULL;
+    }
+    free(trace->index);
+    trace->index = NULL;
+    trace_buf_free(&trace->state);
+}
@@ -0,0 +1,3 @@
+PASSO 1
+POS 5 1
+F
@@ -0,0 +1,3 @@
+PASSO 2
+POS 1 8
+F